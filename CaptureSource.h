@@ -0,0 +1,35 @@
+#ifndef S2500_IMAGE_VIEWER_CAPTURESOURCE_H
+#define S2500_IMAGE_VIEWER_CAPTURESOURCE_H
+
+#include <cstdint>
+#include <sys/types.h>
+#include "SampleRing.h"
+
+/**
+ * Somewhere the acquisition thread can get samples from: the STM32 over a tty, a recording, or the simulator.
+ */
+class CaptureSource {
+    public:
+        virtual ~CaptureSource() = default;
+
+        virtual bool open() = 0;
+        virtual void close() = 0;
+
+        /**
+         * Fills chunk with the next samples, either by writing chunk->storage (up to SAMPLE_RING_CHUNK_BYTES) or by
+         * pointing chunk->data at memory that stays valid until close().
+         * @return Number of bytes in the chunk, 0 if nothing is available right now, -1 on error
+         */
+        virtual ssize_t read(SampleChunk *chunk) = 0;
+
+        /**
+         * @return True if the source keeps producing whether or not we keep up (a real device), in which case a full
+         * ring means dropping data. Otherwise the acquisition thread just waits for the decoder.
+         */
+        virtual bool isLive() = 0;
+
+        virtual bool sendCommand(uint8_t) { return false; }
+        virtual const char *getName() = 0;
+};
+
+#endif //S2500_IMAGE_VIEWER_CAPTURESOURCE_H
@@ -0,0 +1,215 @@
+#include "DecodeKernels.h"
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DECODE_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+static inline bool IsSyncMarker(uint16_t sample) {
+    return static_cast<uint16_t>(sample - 0xFEFA) <= 2;
+}
+
+static size_t FindSyncMarkerScalar(const uint16_t *buf, size_t count) {
+    for (size_t i=0; i<count; i++) {
+        if (IsSyncMarker(buf[i])) {
+            return i;
+        }
+    }
+    return count;
+}
+
+static void MinMaxScalar(const uint16_t *buf, size_t count, uint16_t maxLimit, uint16_t *min, uint16_t *max) {
+    uint16_t lo = *min;
+    uint16_t hi = *max;
+    for (size_t i=0; i<count; i++) {
+        if (buf[i] < lo) {
+            lo = buf[i];
+        }
+        if (buf[i] > hi && buf[i] < maxLimit) {
+            hi = buf[i];
+        }
+    }
+    *min = lo;
+    *max = hi;
+}
+
+/**
+ * There's no scatter to vectorize this with (and AVX2 has none), so every instruction set uses this one. It keeps
+ * four independent increments in flight; splitting the counts across interleaved sub-histograms as well measured
+ * slower, because the extra bins no longer fit in L1.
+ */
+static void HistogramScalar(const uint16_t *buf, size_t count, size_t step, uint16_t limit, uint32_t *bins) {
+    size_t i = 0;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+    uint16_t d;
+
+    for (; i + 3 * step < count; i += 4 * step) {
+        a = buf[i];
+        b = buf[i + step];
+        c = buf[i + 2 * step];
+        d = buf[i + 3 * step];
+        bins[a < limit ? a : limit]++;
+        bins[b < limit ? b : limit]++;
+        bins[c < limit ? c : limit]++;
+        bins[d < limit ? d : limit]++;
+    }
+    for (; i < count; i += step) {
+        a = buf[i];
+        bins[a < limit ? a : limit]++;
+    }
+}
+
+#ifdef DECODE_KERNELS_X86
+
+// SSE2 has no unsigned 16-bit min/max/compare, so samples are biased by 0x8000 and compared as signed
+
+static size_t FindSyncMarkerSSE2(const uint16_t *buf, size_t count) {
+    const __m128i first = _mm_set1_epi16(static_cast<short>(0xFEFA));
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + i));
+        __m128i isMarker = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_sub_epi16(v, first), two), zero);
+        int mask = _mm_movemask_epi8(isMarker);
+        if (mask) {
+            return i + __builtin_ctz(mask) / 2;
+        }
+    }
+    return i + FindSyncMarkerScalar(buf + i, count - i);
+}
+
+static void MinMaxSSE2(const uint16_t *buf, size_t count, uint16_t maxLimit, uint16_t *min, uint16_t *max) {
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i limit = _mm_set1_epi16(static_cast<short>(maxLimit ^ 0x8000));
+    __m128i vmin = _mm_set1_epi16(static_cast<short>(*min ^ 0x8000));
+    __m128i vmax = _mm_set1_epi16(static_cast<short>(*max ^ 0x8000));
+    uint16_t lanes[8];
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + i)), bias);
+        __m128i inRange = _mm_cmplt_epi16(v, limit);
+        vmin = _mm_min_epi16(vmin, v);
+        vmax = _mm_max_epi16(vmax, _mm_or_si128(_mm_and_si128(inRange, v), _mm_andnot_si128(inRange, bias)));
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), _mm_xor_si128(vmin, bias));
+    for (int l=0; l<8; l++) {
+        if (lanes[l] < *min) {
+            *min = lanes[l];
+        }
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), _mm_xor_si128(vmax, bias));
+    for (int l=0; l<8; l++) {
+        if (lanes[l] > *max) {
+            *max = lanes[l];
+        }
+    }
+    MinMaxScalar(buf + i, count - i, maxLimit, min, max);
+}
+
+__attribute__((target("avx2")))
+static size_t FindSyncMarkerAVX2(const uint16_t *buf, size_t count) {
+    const __m256i first = _mm256_set1_epi16(static_cast<short>(0xFEFA));
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buf + i));
+        __m256i isMarker = _mm256_cmpeq_epi16(_mm256_subs_epu16(_mm256_sub_epi16(v, first), two), zero);
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(isMarker));
+        if (mask) {
+            return i + __builtin_ctz(mask) / 2;
+        }
+    }
+    return i + FindSyncMarkerScalar(buf + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void MinMaxAVX2(const uint16_t *buf, size_t count, uint16_t maxLimit, uint16_t *min, uint16_t *max) {
+    uint16_t lanes[16];
+    size_t i = 0;
+
+    if (maxLimit == 0) {
+        MinMaxScalar(buf, count, maxLimit, min, max);
+        return;
+    }
+
+    const __m256i belowLimit = _mm256_set1_epi16(static_cast<short>(maxLimit - 1));
+    __m256i vmin = _mm256_set1_epi16(static_cast<short>(*min));
+    __m256i vmax = _mm256_set1_epi16(static_cast<short>(*max));
+
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buf + i));
+        __m256i inRange = _mm256_cmpeq_epi16(_mm256_min_epu16(v, belowLimit), v);
+        vmin = _mm256_min_epu16(vmin, v);
+        vmax = _mm256_max_epu16(vmax, _mm256_and_si256(inRange, v));
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), vmin);
+    for (int l=0; l<16; l++) {
+        if (lanes[l] < *min) {
+            *min = lanes[l];
+        }
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), vmax);
+    for (int l=0; l<16; l++) {
+        if (lanes[l] > *max) {
+            *max = lanes[l];
+        }
+    }
+    MinMaxScalar(buf + i, count - i, maxLimit, min, max);
+}
+
+#endif // DECODE_KERNELS_X86
+
+static const DecodeKernels scalarKernels = { "scalar", FindSyncMarkerScalar, MinMaxScalar, HistogramScalar };
+#ifdef DECODE_KERNELS_X86
+static const DecodeKernels sse2Kernels = { "SSE2", FindSyncMarkerSSE2, MinMaxSSE2, HistogramScalar };
+static const DecodeKernels avx2Kernels = { "AVX2", FindSyncMarkerAVX2, MinMaxAVX2, HistogramScalar };
+#endif
+
+static const DecodeKernels *SelectDecodeKernels() {
+#ifdef DECODE_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &avx2Kernels;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &sse2Kernels;
+    }
+#endif
+    return &scalarKernels;
+}
+
+const DecodeKernels &GetDecodeKernels() {
+    static const DecodeKernels *kernels = SelectDecodeKernels();
+    return *kernels;
+}
+
+/**
+ * Looks up a specific implementation, e.g. to compare them in the benchmark
+ * @param name "scalar", "SSE2" or "AVX2"
+ * @return The kernels, or nullptr if they don't exist or this CPU can't run them
+ */
+const DecodeKernels *FindDecodeKernels(const char *name) {
+    if (strcasecmp(name, scalarKernels.name) == 0) {
+        return &scalarKernels;
+    }
+#ifdef DECODE_KERNELS_X86
+    __builtin_cpu_init();
+    if (strcasecmp(name, sse2Kernels.name) == 0 && __builtin_cpu_supports("sse2")) {
+        return &sse2Kernels;
+    }
+    if (strcasecmp(name, avx2Kernels.name) == 0 && __builtin_cpu_supports("avx2")) {
+        return &avx2Kernels;
+    }
+#endif
+    return nullptr;
+}
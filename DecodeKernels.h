@@ -0,0 +1,28 @@
+#ifndef S2500_IMAGE_VIEWER_DECODEKERNELS_H
+#define S2500_IMAGE_VIEWER_DECODEKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The sample scanning loops of the decoder, picked once at startup for the best instruction set the CPU supports
+ * (AVX2, SSE2, or plain C++). Every implementation produces bit-identical output.
+ */
+struct DecodeKernels {
+    const char *name;
+
+    // Returns the index of the first 0xFEFA/0xFEFB/0xFEFC sync marker in buf, or count if there isn't one
+    size_t (*findSyncMarker)(const uint16_t *buf, size_t count);
+
+    // Widens *min/*max to cover buf. Samples >= maxLimit (e.g. MAX_ADC_VAL) don't count towards the max
+    void (*minMax)(const uint16_t *buf, size_t count, uint16_t maxLimit, uint16_t *min, uint16_t *max);
+
+    // Counts every step'th sample of buf, starting with the first, into bins[sample]. bins has limit + 1 entries:
+    // samples >= limit all go in the last one
+    void (*histogram)(const uint16_t *buf, size_t count, size_t step, uint16_t limit, uint32_t *bins);
+};
+
+const DecodeKernels &GetDecodeKernels();
+const DecodeKernels *FindDecodeKernels(const char *name);
+
+#endif //S2500_IMAGE_VIEWER_DECODEKERNELS_H
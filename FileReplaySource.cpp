@@ -0,0 +1,203 @@
+#include "FileReplaySource.h"
+#include "DecodeKernels.h"
+#include "Logger.h"
+#include "sem_capture_info.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#define REPLAY_MAX_ROW_SECONDS 1.0
+
+FileReplaySource::FileReplaySource(const char *path) {
+    this->path = path;
+}
+
+FileReplaySource::~FileReplaySource() {
+    close();
+}
+
+/**
+ * Maps the recording read-only
+ * @return True if the file was opened and mapped
+ */
+bool FileReplaySource::open() {
+    struct stat st = {0};
+
+    close();
+    fd = ::open(path, O_RDONLY, 0);
+    if (fd == -1) {
+        Logger::Instance()->log("Unable to open file %s!", path);
+        return false;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(uint16_t)) {
+        Logger::Instance()->log("Recording %s is empty", path);
+        close();
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        Logger::Instance()->log("Unable to mmap %s!", path);
+        close();
+        return false;
+    }
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+    samples = static_cast<const uint16_t *>(mapping);
+    mappedBytes = st.st_size;
+    numSamples = mappedBytes / sizeof(uint16_t);
+    rewind();
+    Logger::Instance()->log("Replaying %s (%f MB)", path, mappedBytes/1e6);
+    return true;
+}
+
+void FileReplaySource::close() {
+    if (samples) {
+        munmap(const_cast<uint16_t *>(samples), mappedBytes);
+        samples = nullptr;
+    }
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+    mappedBytes = 0;
+    numSamples = 0;
+}
+
+/**
+ * Hands out the next chunk of the recording according to the current mode. In real-time mode this sleeps until the
+ * chunk is due.
+ * @param data Set to point into the mapping. Valid until close()
+ * @return Number of bytes at *data, or 0 at the end of the recording or while waiting for a step
+ */
+ssize_t FileReplaySource::next(const uint16_t **data) {
+    size_t start = position.load();
+    size_t end = nextChunkEnd(start);
+    size_t syncEnd;
+    double rowSeconds;
+
+    if (start >= numSamples) {
+        return 0;
+    }
+
+    switch (mode.load()) {
+        case REPLAY_AS_FAST_AS_POSSIBLE:
+            playbackClockStarted = false;
+            break;
+        case REPLAY_REAL_TIME:
+            rowSeconds = 0;
+            syncEnd = findNextSync(start, false);
+            if (syncEnd == start) {
+                rowSeconds = rowDurationAt(start);
+                syncEnd = findNextSync(start + SYNC_PACKET_SAMPLES, false);
+            }
+            if (syncEnd < end) {
+                end = syncEnd;
+            }
+
+            if (!playbackClockStarted || std::chrono::steady_clock::now() - playbackClock > std::chrono::seconds(1)) {
+                // First row, or we've fallen too far behind to catch up (e.g. after a mode switch)
+                playbackClock = std::chrono::steady_clock::now();
+                playbackClockStarted = true;
+            }
+            playbackClock += std::chrono::microseconds((int64_t)(rowSeconds * 1e6));
+            std::this_thread::sleep_until(playbackClock);
+            break;
+        case REPLAY_SINGLE_STEP:
+            playbackClockStarted = false;
+            if (stepsRequested.load() == 0) {
+                return 0;
+            }
+            syncEnd = findNextSync(samples[start] == 0xFEFB ? start + SYNC_PACKET_SAMPLES : start, true);
+            if (syncEnd <= end) {
+                // This chunk finishes the frame
+                end = syncEnd;
+                stepsRequested--;
+            }
+            break;
+    }
+
+    *data = samples + start;
+    position = end;
+    return (end - start) * sizeof(uint16_t);
+}
+
+/**
+ * Points the chunk straight into the mapping; no samples are copied
+ */
+ssize_t FileReplaySource::read(SampleChunk *chunk) {
+    return next(&chunk->data);
+}
+
+bool FileReplaySource::isLive() {
+    return false;
+}
+
+const char *FileReplaySource::getName() {
+    return path;
+}
+
+void FileReplaySource::requestStep() {
+    stepsRequested++;
+}
+
+void FileReplaySource::rewind() {
+    position = 0;
+    stepsRequested = 0;
+    playbackClockStarted = false;
+}
+
+/**
+ * @param from
+ * @param frameSyncOnly Skip X syncs and heartbeats, only stop at 0xFEFB
+ * @return Index of the next sync marker at or after from, or numSamples
+ */
+size_t FileReplaySource::findNextSync(size_t from, bool frameSyncOnly) {
+    const DecodeKernels &kernels = GetDecodeKernels();
+    size_t i = from;
+
+    while (i < numSamples) {
+        i += kernels.findSyncMarker(samples + i, numSamples - i);
+        if (i >= numSamples || !frameSyncOnly || samples[i] == 0xFEFB) {
+            break;
+        }
+        i += SYNC_PACKET_SAMPLES;
+    }
+    return i < numSamples ? i : numSamples;
+}
+
+/**
+ * @param from
+ * @return End of a REPLAY_CHUNK_SAMPLES chunk starting at from. The decoder carries packets over chunk boundaries,
+ * so this doesn't need to line up with the stream
+ */
+size_t FileReplaySource::nextChunkEnd(size_t from) {
+    size_t end = from + REPLAY_CHUNK_SAMPLES;
+
+    return end < numSamples ? end : numSamples;
+}
+
+/**
+ * @param i Index of a sync marker
+ * @return The row duration carried by the packet, in seconds, in the same units the decoder reports
+ */
+double FileReplaySource::rowDurationAt(size_t i) {
+    double seconds;
+
+    if (samples[i] == 0xFEFC || i + SYNC_PACKET_SAMPLES > numSamples) {
+        return 0;
+    }
+    seconds = samples[i + 4] / 16;
+    seconds += ((double)samples[i + 5]) / 1e6;
+    return seconds > REPLAY_MAX_ROW_SECONDS ? REPLAY_MAX_ROW_SECONDS : seconds;
+}
+
+size_t FileReplaySource::getPositionBytes() {
+    return position.load() * sizeof(uint16_t);
+}
+
+size_t FileReplaySource::getSizeBytes() {
+    return mappedBytes;
+}
@@ -0,0 +1,62 @@
+#ifndef S2500_IMAGE_VIEWER_FILEREPLAYSOURCE_H
+#define S2500_IMAGE_VIEWER_FILEREPLAYSOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include "CaptureSource.h"
+
+#define REPLAY_CHUNK_SAMPLES (128 * 1024)
+
+enum ReplayMode {
+    REPLAY_AS_FAST_AS_POSSIBLE,
+    REPLAY_REAL_TIME,
+    REPLAY_SINGLE_STEP,
+};
+
+/**
+ * Replays a recorded capture by memory-mapping it and handing out pointers straight into the mapping, so the
+ * decoder sees the recording without any read() copies.
+ *
+ * REPLAY_AS_FAST_AS_POSSIBLE hands out large chunks as quickly as the decoder takes them (for benchmarking),
+ * REPLAY_REAL_TIME hands out one row at a time paced by the row durations embedded in the sync packets, and
+ * REPLAY_SINGLE_STEP hands out one frame per requestStep().
+ */
+class FileReplaySource : public CaptureSource {
+    private:
+        const char *path;
+        int fd = -1;
+        const uint16_t *samples = nullptr;
+        size_t mappedBytes = 0;
+        size_t numSamples = 0;
+        std::atomic<size_t> position{0};
+        std::atomic<uint32_t> stepsRequested{0};
+        std::chrono::steady_clock::time_point playbackClock;
+        bool playbackClockStarted = false;
+
+        size_t findNextSync(size_t from, bool frameSyncOnly);
+        size_t nextChunkEnd(size_t from);
+        double rowDurationAt(size_t i);
+
+    public:
+        std::atomic<ReplayMode> mode{REPLAY_REAL_TIME};
+
+        FileReplaySource(const char *path);
+        ~FileReplaySource() override;
+
+        bool open() override;
+        void close() override;
+        ssize_t read(SampleChunk *chunk) override;
+        bool isLive() override;
+        const char *getName() override;
+
+        ssize_t next(const uint16_t **data);
+        void requestStep();
+        void rewind();
+        size_t getPositionBytes();
+        size_t getSizeBytes();
+};
+
+#endif //S2500_IMAGE_VIEWER_FILEREPLAYSOURCE_H
@@ -0,0 +1,75 @@
+#include "FrameGeometryTracker.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstdlib>
+
+/**
+ * Called on every X pulse: the row before it is finished
+ */
+void FrameGeometryTracker::endRow() {
+    if (rowSamples) {
+        widestRow = std::max(widestRow, rowSamples);
+        rows++;
+        rowSamples = 0;
+    }
+}
+
+/**
+ * Called on frame sync with the frame that just finished.
+ * @param scannedMode The scan mode the finished frame was scanned in
+ * @param nextMode The one the frame starting now will be
+ * @param current The geometry the decoder is using
+ * @return The geometry to scan the next frame at: nextMode's, if it's known, or else current
+ */
+FrameGeometry FrameGeometryTracker::endFrame(uint8_t scannedMode, uint8_t nextMode, FrameGeometry current) {
+    FrameGeometry measured;
+
+    endRow();
+    measured.width = (uint16_t)std::min<uint32_t>((widestRow + 3) & ~3u, GEOMETRY_MAX_SIDE + 1);
+    measured.height = (uint16_t)std::min<uint32_t>(rows, GEOMETRY_MAX_SIDE + 1);
+    widestRow = 0;
+    rows = 0;
+
+    if (measured.width < GEOMETRY_MIN_SIDE || measured.height < GEOMETRY_MIN_SIDE ||
+        measured.width > GEOMETRY_MAX_SIDE || measured.height > GEOMETRY_MAX_SIDE) {
+        candidateFrames = 0;
+    } else if (candidateFrames && candidateMode == scannedMode && Alike(measured, candidate)) {
+        // Row lengths jitter by a sample or two; keep the widest so no row overflows
+        candidate.width = std::max(candidate.width, measured.width);
+        candidate.height = std::max(candidate.height, measured.height);
+        candidateFrames++;
+    } else {
+        candidate = measured;
+        candidateMode = scannedMode;
+        candidateFrames = 1;
+    }
+
+    if (candidateFrames >= GEOMETRY_CONFIRM_FRAMES) {
+        FrameGeometry &mode = known[scannedMode];
+        if (!Alike(candidate, mode) || candidate.width > mode.width || candidate.height > mode.height) {
+            if (Alike(candidate, mode)) {
+                candidate.width = std::max(candidate.width, mode.width);
+                candidate.height = std::max(candidate.height, mode.height);
+            }
+            Logger::Instance()->log("[INFO] Scan mode %d frames are %dx%d", scannedMode, candidate.width,
+                                    candidate.height);
+            mode = candidate;
+        }
+    }
+    return known[nextMode].width ? known[nextMode] : current;
+}
+
+/**
+ * Forgets the row and frame being measured, e.g. when the stream restarts. What's known about each scan mode stays.
+ */
+void FrameGeometryTracker::reset() {
+    rowSamples = 0;
+    widestRow = 0;
+    rows = 0;
+    candidateFrames = 0;
+}
+
+bool FrameGeometryTracker::Alike(FrameGeometry a, FrameGeometry b) {
+    return std::abs(a.width - b.width) <= GEOMETRY_WIDTH_TOLERANCE &&
+           std::abs(a.height - b.height) <= GEOMETRY_HEIGHT_TOLERANCE;
+}
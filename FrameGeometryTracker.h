@@ -0,0 +1,46 @@
+#ifndef S2500_IMAGE_VIEWER_FRAMEGEOMETRYTRACKER_H
+#define S2500_IMAGE_VIEWER_FRAMEGEOMETRYTRACKER_H
+
+#include <cstdint>
+
+#define GEOMETRY_SCAN_MODES         256
+#define GEOMETRY_CONFIRM_FRAMES     2       // frames measured alike before they're believed
+#define GEOMETRY_MIN_SIDE           16      // anything smaller is a frame cut short, not a geometry
+#define GEOMETRY_MAX_SIDE           16384
+#define GEOMETRY_WIDTH_TOLERANCE    8       // samples the widest row can vary by and still be the same geometry
+#define GEOMETRY_HEIGHT_TOLERANCE   2
+
+struct FrameGeometry {
+    uint16_t width = 0;
+    uint16_t height = 0;
+};
+
+/**
+ * Measures frames from the sync stream: samples per row between X pulses and rows per frame between frame syncs.
+ * Each scan speed has a geometry of its own, so they're learnt per scanMode, once GEOMETRY_CONFIRM_FRAMES frames in a
+ * row have measured alike. Frames that only look different because they were cut short (the first one after
+ * connecting, or a scan restart) never get confirmed. Widths are rounded up to a multiple of 4. Decoder thread only.
+ */
+class FrameGeometryTracker {
+    private:
+        FrameGeometry known[GEOMETRY_SCAN_MODES];
+        FrameGeometry candidate;
+        uint8_t candidateMode = 0;
+        uint32_t candidateFrames = 0;
+        uint32_t rowSamples = 0;
+        uint32_t widestRow = 0;
+        uint32_t rows = 0;
+
+        static bool Alike(FrameGeometry a, FrameGeometry b);
+
+    public:
+        void addSamples(uint32_t count) {
+            rowSamples += count;
+        }
+
+        void endRow();
+        FrameGeometry endFrame(uint8_t scannedMode, uint8_t nextMode, FrameGeometry current);
+        void reset();
+};
+
+#endif //S2500_IMAGE_VIEWER_FRAMEGEOMETRYTRACKER_H
@@ -0,0 +1,199 @@
+#include "FrameRegistration.h"
+#include "ThreadPool.h"
+#include <cmath>
+
+/**
+ * 1-D Hann window of n samples. Left alone if it already has n
+ */
+static void MakeWindow(std::vector<float> &window, uint32_t n) {
+    if (window.size() == n) {
+        return;
+    }
+    window.resize(n);
+    for (uint32_t i=0; i<n; i++) {
+        window[i] = n > 1 ? 0.5f - 0.5f * (float)cos(2.0 * M_PI * i / (n - 1)) : 1.0f;
+    }
+}
+
+/**
+ * Removes the mean of the w x h block at the top-left of a size x size image and tapers it to zero at its edges, so
+ * the frame borders don't correlate with themselves
+ */
+static void Taper(std::vector<float> &image, uint32_t size, uint32_t w, uint32_t h, std::vector<float> &windowX,
+                  std::vector<float> &windowY) {
+    double sum = 0;
+    float mean;
+
+    for (uint32_t y=0; y<h; y++) {
+        for (uint32_t x=0; x<w; x++) {
+            sum += image[(size_t)y * size + x];
+        }
+    }
+    mean = w && h ? (float)(sum / ((double)w * h)) : 0.0f;
+    for (uint32_t y=0; y<h; y++) {
+        for (uint32_t x=0; x<w; x++) {
+            float &v = image[(size_t)y * size + x];
+            v = (v - mean) * windowX[x] * windowY[y];
+        }
+    }
+}
+
+FrameRegistration::FrameRegistration() {
+    coarseImage.resize((size_t)REGISTRATION_COARSE_SIZE * REGISTRATION_COARSE_SIZE);
+    fineImage.resize((size_t)REGISTRATION_FINE_SIZE * REGISTRATION_FINE_SIZE);
+}
+
+void FrameRegistration::setReference(const SEMFrameSnapshot &frame) {
+    width = frame.width;
+    height = frame.height;
+    factor = 1;
+    while (width / factor > REGISTRATION_COARSE_SIZE || height / factor > REGISTRATION_COARSE_SIZE) {
+        factor *= 2;
+    }
+
+    prepareCoarse(frame);
+    coarse.setReference(coarseImage.data());
+    prepareFine(frame, 0, 0);
+    fine.setReference(fineImage.data());
+    referenceLeft = fineLeft;
+    referenceTop = fineTop;
+}
+
+/**
+ * Box-filters the frame down by factor into the top-left of coarseImage and tapers it
+ */
+void FrameRegistration::prepareCoarse(const SEMFrameSnapshot &frame) {
+    uint32_t w = frame.width / factor;
+    uint32_t h = frame.height / factor;
+    float scale = 1.0f / (factor * factor);
+
+    std::fill(coarseImage.begin(), coarseImage.end(), 0.0f);
+    for (uint32_t y=0; y<h*factor; y++) {
+        const uint16_t *row = frame.pixels + (size_t)y * frame.width;
+        float *out = coarseImage.data() + (size_t)(y / factor) * REGISTRATION_COARSE_SIZE;
+        for (uint32_t x=0; x<w*factor; x++) {
+            out[x / factor] += row[x];
+        }
+    }
+    for (float &v : coarseImage) {
+        v *= scale;
+    }
+    MakeWindow(coarseWindowX, w);
+    MakeWindow(coarseWindowY, h);
+    Taper(coarseImage, REGISTRATION_COARSE_SIZE, w, h, coarseWindowX, coarseWindowY);
+}
+
+/**
+ * Copies a REGISTRATION_FINE_SIZE patch from the middle of the frame, moved by offset, into fineImage and tapers it
+ */
+void FrameRegistration::prepareFine(const SEMFrameSnapshot &frame, int32_t offsetX, int32_t offsetY) {
+    uint32_t w = frame.width < REGISTRATION_FINE_SIZE ? frame.width : REGISTRATION_FINE_SIZE;
+    uint32_t h = frame.height < REGISTRATION_FINE_SIZE ? frame.height : REGISTRATION_FINE_SIZE;
+    int32_t left = (int32_t)(frame.width - w) / 2 + offsetX;
+    int32_t top = (int32_t)(frame.height - h) / 2 + offsetY;
+
+    left = left < 0 ? 0 : left > (int32_t)(frame.width - w) ? (int32_t)(frame.width - w) : left;
+    top = top < 0 ? 0 : top > (int32_t)(frame.height - h) ? (int32_t)(frame.height - h) : top;
+    fineLeft = left;
+    fineTop = top;
+
+    std::fill(fineImage.begin(), fineImage.end(), 0.0f);
+    for (uint32_t y=0; y<h; y++) {
+        const uint16_t *row = frame.pixels + (size_t)(top + y) * frame.width + left;
+        float *out = fineImage.data() + (size_t)y * REGISTRATION_FINE_SIZE;
+        for (uint32_t x=0; x<w; x++) {
+            out[x] = row[x];
+        }
+    }
+    MakeWindow(fineWindowX, w);
+    MakeWindow(fineWindowY, h);
+    Taper(fineImage, REGISTRATION_FINE_SIZE, w, h, fineWindowX, fineWindowY);
+}
+
+/**
+ * Measures how far the content of frame has moved since the reference frame
+ * @param frame Must be the same size as the reference
+ * @param dx
+ * @param dy
+ * @param peak Correlation peak of the match used, 0 to 1
+ * @return False if the frames couldn't be matched
+ */
+bool FrameRegistration::estimate(const SEMFrameSnapshot &frame, float *dx, float *dy, float *peak) {
+    float coarseX, coarseY, coarsePeak;
+    float fineX, fineY, finePeak;
+
+    if (frame.width != width || frame.height != height) {
+        return false;
+    }
+    prepareCoarse(frame);
+    if (!coarse.correlate(coarseImage.data(), &coarseX, &coarseY, &coarsePeak) || coarsePeak < REGISTRATION_MIN_PEAK) {
+        *peak = coarsePeak;
+        return false;
+    }
+    coarseX *= factor;
+    coarseY *= factor;
+
+    // Line the patch up with the reference's using the coarse estimate, then measure what's left over
+    prepareFine(frame, (int32_t)lroundf(coarseX), (int32_t)lroundf(coarseY));
+    if (!fine.correlate(fineImage.data(), &fineX, &fineY, &finePeak) || finePeak < REGISTRATION_MIN_PEAK) {
+        *dx = coarseX;
+        *dy = coarseY;
+        *peak = coarsePeak;
+        return true;
+    }
+    *dx = fineX + (fineLeft - referenceLeft);
+    *dy = fineY + (fineTop - referenceTop);
+    *peak = finePeak;
+    return true;
+}
+
+/**
+ * Moves the content of frame back by (dx, dy) with bilinear interpolation, so it lines up with the reference.
+ * Pixels that would come from outside the frame repeat its edge.
+ * @param frame
+ * @param dx Drift measured by estimate()
+ * @param dy
+ * @param out width * height pixels
+ * @param pool Splits the rows up, or nullptr
+ */
+void FrameRegistration::resample(const SEMFrameSnapshot &frame, float dx, float dy, uint16_t *out, ThreadPool *pool) {
+    const uint32_t w = frame.width;
+    const uint32_t h = frame.height;
+    std::vector<uint32_t> x0(w), x1(w);
+    std::vector<float> fx(w);
+
+    for (uint32_t x=0; x<w; x++) {
+        float sx = x + dx;
+        float base = floorf(sx);
+        int32_t i = (int32_t)base;
+        fx[x] = sx - base;
+        x0[x] = i < 0 ? 0 : i >= (int32_t)w ? w - 1 : i;
+        x1[x] = i + 1 < 0 ? 0 : i + 1 >= (int32_t)w ? w - 1 : i + 1;
+    }
+
+    const uint32_t bands = 32;
+    const uint32_t bandRows = (h + bands - 1) / bands;
+    auto resampleBand = [&](uint32_t band) {
+        for (uint32_t y=band*bandRows; y<h && y<(band+1)*bandRows; y++) {
+            float sy = y + dy;
+            float base = floorf(sy);
+            int32_t i = (int32_t)base;
+            float fy = sy - base;
+            const uint16_t *row0 = frame.pixels + (size_t)(i < 0 ? 0 : i >= (int32_t)h ? h - 1 : i) * w;
+            const uint16_t *row1 = frame.pixels + (size_t)(i + 1 < 0 ? 0 : i + 1 >= (int32_t)h ? h - 1 : i + 1) * w;
+            uint16_t *target = out + (size_t)y * w;
+            for (uint32_t x=0; x<w; x++) {
+                float top = row0[x0[x]] + (row0[x1[x]] - row0[x0[x]]) * fx[x];
+                float bottom = row1[x0[x]] + (row1[x1[x]] - row1[x0[x]]) * fx[x];
+                target[x] = (uint16_t)(top + (bottom - top) * fy + 0.5f);
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(bands, resampleBand);
+    } else {
+        for (uint32_t band=0; band<bands; band++) {
+            resampleBand(band);
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef S2500_IMAGE_VIEWER_FRAMEREGISTRATION_H
+#define S2500_IMAGE_VIEWER_FRAMEREGISTRATION_H
+
+#include <cstdint>
+#include <vector>
+#include "PhaseCorrelator.h"
+#include "sem_frame_snapshot.h"
+
+#define REGISTRATION_COARSE_SIZE    256  // the whole frame, box-filtered down to fit
+#define REGISTRATION_FINE_SIZE      256  // a full-resolution patch from the middle of the frame
+#define REGISTRATION_MIN_PEAK       0.02f // below this the match is treated as lost
+
+class ThreadPool;
+
+/**
+ * Measures the drift of each frame relative to a reference frame, in two steps: phase correlation of the whole frame
+ * box-filtered down to REGISTRATION_COARSE_SIZE finds the shift to within a couple of pixels over a wide range, then
+ * phase correlation of full-resolution patches from the middle of both frames, offset by that estimate, refines it to
+ * a fraction of a pixel. resample() then moves a frame back onto the reference.
+ */
+class FrameRegistration {
+    private:
+        PhaseCorrelator coarse{REGISTRATION_COARSE_SIZE};
+        PhaseCorrelator fine{REGISTRATION_FINE_SIZE};
+        std::vector<float> coarseImage;
+        std::vector<float> fineImage;
+        std::vector<float> coarseWindowX;   // built once per size
+        std::vector<float> coarseWindowY;
+        std::vector<float> fineWindowX;
+        std::vector<float> fineWindowY;
+        uint32_t factor = 1;            // downsampling of the coarse level
+        int32_t fineLeft = 0;           // where prepareFine() took its patch from
+        int32_t fineTop = 0;
+        int32_t referenceLeft = 0;      // and where it took the reference's from
+        int32_t referenceTop = 0;
+        uint16_t width = 0;
+        uint16_t height = 0;
+
+        void prepareCoarse(const SEMFrameSnapshot &frame);
+        void prepareFine(const SEMFrameSnapshot &frame, int32_t offsetX, int32_t offsetY);
+
+    public:
+        FrameRegistration();
+        void setReference(const SEMFrameSnapshot &frame);
+        bool estimate(const SEMFrameSnapshot &frame, float *dx, float *dy, float *peak);
+        static void resample(const SEMFrameSnapshot &frame, float dx, float dy, uint16_t *out, ThreadPool *pool);
+};
+
+#endif //S2500_IMAGE_VIEWER_FRAMEREGISTRATION_H
@@ -0,0 +1,379 @@
+#include "FrameStacker.h"
+#include "FrameStore.h"
+#include "SequenceWriter.h"
+#include "SEMDecoder.h"
+#include "ThreadPool.h"
+#include "Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+/**
+ * Makes sure snapshot can hold samples pixels
+ */
+static void ReserveSnapshot(SEMFrameSnapshot &snapshot, size_t samples) {
+    if (snapshot.capacity < samples) {
+        free(snapshot.pixels);
+        snapshot.pixels = (uint16_t*)malloc(samples * sizeof(uint16_t));
+        snapshot.capacity = samples;
+    }
+}
+
+FrameStacker::FrameStacker(SequenceWriter *writer) {
+    this->writer = writer;
+    this->kernels = &GetStackKernels();
+    Logger::Instance()->log("Using %s stack kernels", kernels->name);
+}
+
+FrameStacker::~FrameStacker() {
+    stop();
+    delete pool;
+    free(aligned.pixels);
+    free(result.pixels);
+    free(preview.pixels);
+}
+
+void FrameStacker::start() {
+    std::lock_guard<std::mutex> lock(frameMutex);
+    if (running) {
+        return;
+    }
+    running = true;
+    stackThread = std::thread(&FrameStacker::stackLoop, this);
+}
+
+void FrameStacker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        if (!running) {
+            return;
+        }
+        running = false;
+    }
+    frameReady.notify_all();
+    stackThread.join();
+    std::lock_guard<std::mutex> lock(frameMutex);
+    dropIncoming();
+}
+
+/**
+ * Starts a new stack with the first frame that is scanned completely from here on
+ */
+void FrameStacker::begin() {
+    std::lock_guard<std::mutex> lock(frameMutex);
+    resetRequested = true;
+    skipNextFrame = true;
+    dropIncoming();
+    finishRequested = false;
+    active = true;
+    Logger::Instance()->log("Stacking from the next frame%s%s", sigmaClip ? ", sigma clipped" : "",
+                            correctDrift ? ", drift corrected" : "");
+}
+
+/**
+ * Stops taking frames; the stacking thread finishes the one it has, if any, and saves the result
+ */
+void FrameStacker::end() {
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        if (!active) {
+            return;
+        }
+        active = false;
+        finishRequested = true;
+    }
+    frameReady.notify_one();
+}
+
+bool FrameStacker::isStacking() {
+    return active;
+}
+
+/**
+ * Called by the decoder on frame sync with the frame it just published
+ * @param frames The store the frame is pinned in
+ * @param frame Pinned by the caller, for the stacker to unpin
+ */
+void FrameStacker::queueFrame(FrameStore &frames, const SEMFrameSnapshot *frame) {
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        if (!active) {
+            frames.unpin(frame);
+            return;
+        }
+        if (skipNextFrame) {
+            // Started partway through this one
+            skipNextFrame = false;
+            frames.unpin(frame);
+            return;
+        }
+        if (incoming) {
+            framesSkipped++;
+            dropIncoming();
+        }
+        store = &frames;
+        incoming = frame;
+    }
+    frameReady.notify_one();
+}
+
+/**
+ * Lets go of the frame waiting to be stacked, if there is one. frameMutex must be held.
+ */
+void FrameStacker::dropIncoming() {
+    if (incoming) {
+        store->unpin(incoming);
+        incoming = nullptr;
+    }
+}
+
+void FrameStacker::stackLoop() {
+    const SEMFrameSnapshot *working;
+    FrameStore *workingStore;
+    bool reset;
+
+    std::unique_lock<std::mutex> lock(frameMutex);
+    while (true) {
+        frameReady.wait(lock, [this] { return incoming || finishRequested || !running; });
+        if (incoming) {
+            working = incoming;
+            workingStore = store;
+            incoming = nullptr;
+            reset = resetRequested;
+            resetRequested = false;
+            lock.unlock();
+
+            if (!reset && (working->width != width || working->height != height)) {
+                Logger::Instance()->log("Frame size changed to %dx%d, restarting the stack", working->width,
+                                        working->height);
+                reset = true;
+            }
+            if (reset) {
+                resetStack(*working);
+            }
+            const SEMFrameSnapshot *frame = registerFrame(*working);
+            if (frame) {
+                addFrame(*frame);
+                renderPreview(*frame);
+            }
+            workingStore->unpin(working);
+
+            lock.lock();
+            continue;
+        }
+        if (finishRequested) {
+            finishRequested = false;
+            lock.unlock();
+            finish();
+            lock.lock();
+            continue;
+        }
+        break;
+    }
+}
+
+void FrameStacker::resetStack(const SEMFrameSnapshot &frame) {
+    width = frame.width;
+    height = frame.height;
+    samples = (size_t)width * height;
+    frames = 0;
+    framesStacked = 0;
+    framesSkipped = 0;
+    framesUnregistered = 0;
+    driftX = 0;
+    driftY = 0;
+    driftPeak = 0;
+    drift.clear();
+    clipping = sigmaClip;
+    registering = correctDrift;
+    if (registering) {
+        registration.setReference(frame);
+    }
+    if (clipping) {
+        sum.clear();
+        mean.assign(samples, 0.0f);
+        m2.assign(samples, 0.0f);
+        count.assign(samples, 0.0f);
+    } else {
+        sum.assign(samples, 0);
+        mean.clear();
+        m2.clear();
+        count.clear();
+    }
+    if (!pool) {
+        pool = new ThreadPool();
+    }
+}
+
+/**
+ * Lines frame up with the first frame of the stack, if drift correction is on, and records the drift measured
+ * @param frame
+ * @return frame itself, the aligned copy of it, or nullptr if it couldn't be matched and mustn't be stacked
+ */
+const SEMFrameSnapshot *FrameStacker::registerFrame(const SEMFrameSnapshot &frame) {
+    float dx, dy, peak = 0;
+    uint16_t *buffer;
+    size_t capacity;
+
+    if (!registering) {
+        return &frame;
+    }
+    if (frames == 0) {
+        // The reference needs no moving
+        drift.push_back({ frame.frameNumber, 0.0f, 0.0f, 1.0f, true });
+        return &frame;
+    }
+    auto registerStart = std::chrono::steady_clock::now();
+    if (!registration.estimate(frame, &dx, &dy, &peak)) {
+        framesUnregistered++;
+        driftPeak = peak;
+        drift.push_back({ frame.frameNumber, 0.0f, 0.0f, peak, false });
+        Logger::Instance()->log("Frame %u: lost track of the drift (peak %.3f), leaving it out",
+                                frame.frameNumber, peak);
+        return nullptr;
+    }
+
+    ReserveSnapshot(aligned, samples);
+    buffer = aligned.pixels;
+    capacity = aligned.capacity;
+    aligned = frame;
+    aligned.pixels = buffer;
+    aligned.capacity = capacity;
+    aligned.driftX = dx;
+    aligned.driftY = dy;
+    FrameRegistration::resample(frame, dx, dy, aligned.pixels, pool);
+    lastRegisterMilliseconds = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - registerStart).count();
+    driftX = dx;
+    driftY = dy;
+    driftPeak = peak;
+    drift.push_back({ frame.frameNumber, dx, dy, peak, true });
+    Logger::Instance()->log("Frame %u: drift %.2f, %.2f px (peak %.3f)", frame.frameNumber, dx, dy, peak);
+    return &aligned;
+}
+
+void FrameStacker::addFrame(const SEMFrameSnapshot &frame) {
+    size_t bandSamples = (samples + FRAME_STACKER_BANDS - 1) / FRAME_STACKER_BANDS;
+    float clipKappa = kappa;
+    float clipFrames = clipAfterFrames;
+
+    auto addStart = std::chrono::steady_clock::now();
+    pool->parallelFor(FRAME_STACKER_BANDS, [&](uint32_t band) {
+        size_t first = band * bandSamples;
+        if (first >= samples) {
+            return;
+        }
+        size_t n = samples - first < bandSamples ? samples - first : bandSamples;
+        if (clipping) {
+            kernels->accumulateClipped(frame.pixels + first, mean.data() + first, m2.data() + first,
+                                       count.data() + first, n, clipKappa, clipFrames);
+        } else {
+            kernels->accumulate(frame.pixels + first, sum.data() + first, n);
+        }
+    });
+    lastAddMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - addStart).count();
+    frames++;
+    framesStacked = frames;
+}
+
+/**
+ * Turns the accumulators into 16-bit pixels in preview, with frame's capture state
+ */
+void FrameStacker::renderPreview(const SEMFrameSnapshot &frame) {
+    size_t bandSamples = (samples + FRAME_STACKER_BANDS - 1) / FRAME_STACKER_BANDS;
+    uint16_t *buffer;
+    size_t capacity;
+
+    std::lock_guard<std::mutex> lock(previewMutex);
+    ReserveSnapshot(preview, samples);
+    buffer = preview.pixels;
+    capacity = preview.capacity;
+    preview = frame;
+    preview.pixels = buffer;
+    preview.capacity = capacity;
+    preview.stackedFrames = frames;
+
+    pool->parallelFor(FRAME_STACKER_BANDS, [&](uint32_t band) {
+        size_t first = band * bandSamples;
+        if (first >= samples) {
+            return;
+        }
+        size_t n = samples - first < bandSamples ? samples - first : bandSamples;
+        if (clipping) {
+            kernels->meanToPixels(mean.data() + first, n, preview.pixels + first);
+        } else {
+            kernels->sumToPixels(sum.data() + first, n, frames, preview.pixels + first);
+        }
+    });
+    preview.min = MAX_ADC_VAL;
+    preview.max = 0;
+    GetDecodeKernels().minMax(preview.pixels, samples, MAX_ADC_VAL, &preview.min, &preview.max);
+    std::fill(previewHistogram, previewHistogram + SAMPLE_HISTOGRAM_BINS + 1, 0);
+    GetDecodeKernels().histogram(preview.pixels, samples, SAMPLE_HISTOGRAM_STEP, SAMPLE_HISTOGRAM_BINS,
+                                 previewHistogram);
+    previewHistogramSamples = SampleHistogram::Count(previewHistogram, SAMPLE_HISTOGRAM_BINS);
+    previewVersion++;
+}
+
+/**
+ * Queues a copy of the average to be saved. The copy keeps the preview on screen after the stack has ended
+ */
+void FrameStacker::finish() {
+    uint16_t *buffer;
+    size_t capacity;
+
+    if (frames == 0) {
+        Logger::Instance()->log("Stack ended before any frame was complete, nothing to save");
+        return;
+    }
+    Logger::Instance()->log("Saving a stack of %u frames (%llu skipped)", frames,
+                            (unsigned long long)framesSkipped.load());
+    if (!writer) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(previewMutex);
+        ReserveSnapshot(result, samples);
+        buffer = result.pixels;
+        capacity = result.capacity;
+        result = preview;
+        result.pixels = buffer;
+        result.capacity = capacity;
+        memcpy(result.pixels, preview.pixels, samples * sizeof(uint16_t));
+    }
+    result.drift = drift;
+    result.requested = true;
+    stacksQueued++;
+    writer->queueOwnedSnapshot(result);
+}
+
+/**
+ * Gives access to the current average without waiting. Its pixels stay valid and unchanged until unlockPreview()
+ * @return The preview, or nullptr if nothing has been stacked yet or the stacking thread is busy with it
+ */
+const SEMFrameSnapshot *FrameStacker::lockPreview() {
+    if (!previewMutex.try_lock()) {
+        return nullptr;
+    }
+    if (!preview.pixels) {
+        previewMutex.unlock();
+        return nullptr;
+    }
+    return &preview;
+}
+
+/**
+ * The histogram of the preview, sampled like the decoder's. Only valid between lockPreview() and unlockPreview()
+ * @param samples Receives the number of samples counted below SAMPLE_HISTOGRAM_BINS
+ * @return SAMPLE_HISTOGRAM_BINS + 1 bins
+ */
+const uint32_t *FrameStacker::getPreviewHistogram(uint64_t *samples) {
+    *samples = previewHistogramSamples;
+    return previewHistogram;
+}
+
+void FrameStacker::unlockPreview() {
+    previewMutex.unlock();
+}
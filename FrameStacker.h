@@ -0,0 +1,108 @@
+#ifndef S2500_IMAGE_VIEWER_FRAMESTACKER_H
+#define S2500_IMAGE_VIEWER_FRAMESTACKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "sem_frame_snapshot.h"
+#include "FrameRegistration.h"
+#include "SampleHistogram.h"
+#include "StackKernels.h"
+
+#define FRAME_STACKER_BANDS 32 // pieces each frame is split into across the thread pool
+
+class FrameStore;
+class SequenceWriter;
+class ThreadPool;
+
+/**
+ * Averages successive frames to beat down the noise on slow scans. Between begin() and end() the decoder hands every
+ * complete frame to queueFrame(); the stacking thread adds it to a 32-bit sum (plain mean) or a running Welford
+ * mean/variance (sigma-clipped mean), then renders the current average into a preview. end() saves the result through
+ * the SequenceWriter, queued like a "Save next frame" frame so the backpressure policy can never drop it.
+ *
+ * With drift correction on, each frame is first registered against the first frame of the stack and resampled onto it,
+ * so a specimen that wanders by a few pixels over a long stack doesn't smear the average. A frame that can't be matched
+ * is left out rather than stacked unaligned. The drift measured for every frame is saved along with the stack.
+ *
+ * Frames stay pinned in the frame store while they're stacked, so nothing is copied at frame sync. If they arrive
+ * faster than they can be stacked, the stacker only ever keeps the newest one waiting and unpins the rest.
+ */
+class FrameStacker {
+    private:
+        SequenceWriter *writer;
+        const StackKernels *kernels;
+        ThreadPool *pool = nullptr;
+        std::thread stackThread;
+
+        std::mutex frameMutex;
+        std::condition_variable frameReady;
+        FrameStore *store = nullptr;        // the incoming frame is pinned in
+        const SEMFrameSnapshot *incoming = nullptr; // pinned by the decoder, guarded by frameMutex
+        bool skipNextFrame = false;
+        bool resetRequested = false;
+        bool finishRequested = false;
+        bool running = false;
+        std::atomic<bool> active{false};
+
+        // Owned by the stacking thread
+        bool clipping = false;
+        bool registering = false;
+        FrameRegistration registration;
+        SEMFrameSnapshot aligned;           // the frame moved back onto the reference
+        SEMFrameSnapshot result;            // the finished stack, handed over to the writer
+        std::vector<FrameDrift> drift;      // of every frame of the stack so far, when registering
+        size_t samples = 0;
+        uint16_t width = 0;                 // of the frames in the stack
+        uint16_t height = 0;
+        uint32_t frames = 0;
+        std::vector<uint32_t> sum;
+        std::vector<float> mean;
+        std::vector<float> m2;
+        std::vector<float> count;
+
+        std::mutex previewMutex;
+        SEMFrameSnapshot preview;           // the average so far, guarded by previewMutex
+        uint32_t previewHistogram[SAMPLE_HISTOGRAM_BINS + 1]; // of the preview, guarded by previewMutex
+        uint64_t previewHistogramSamples = 0;
+
+        void stackLoop();
+        void dropIncoming();
+        void resetStack(const SEMFrameSnapshot &frame);
+        const SEMFrameSnapshot *registerFrame(const SEMFrameSnapshot &frame);
+        void addFrame(const SEMFrameSnapshot &frame);
+        void renderPreview(const SEMFrameSnapshot &frame);
+        void finish();
+
+    public:
+        std::atomic<bool> sigmaClip{false};     // takes effect at the next begin()
+        std::atomic<float> kappa{3.0f};         // clipping threshold in standard deviations
+        std::atomic<float> clipAfterFrames{8};  // frames a pixel needs before anything is rejected
+        std::atomic<bool> correctDrift{false};  // takes effect at the next begin()
+        std::atomic<uint32_t> framesStacked{0};
+        std::atomic<uint64_t> framesSkipped{0}; // arrived while the previous one was still being stacked
+        std::atomic<double> lastAddMilliseconds{0};
+        std::atomic<double> lastRegisterMilliseconds{0};
+        std::atomic<float> driftX{0};           // shift of the last frame relative to the first, in pixels
+        std::atomic<float> driftY{0};
+        std::atomic<float> driftPeak{0};        // correlation peak of that match
+        std::atomic<uint32_t> framesUnregistered{0}; // couldn't be matched, left out of the stack
+        std::atomic<uint32_t> previewVersion{0};
+        std::atomic<uint32_t> stacksQueued{0};  // finished stacks handed to the writer, counted in its requested frames
+
+        FrameStacker(SequenceWriter *writer);
+        ~FrameStacker();
+        void start();
+        void stop();
+        void begin();
+        void end();
+        bool isStacking();
+        void queueFrame(FrameStore &frames, const SEMFrameSnapshot *frame);
+        const SEMFrameSnapshot *lockPreview();
+        const uint32_t *getPreviewHistogram(uint64_t *samples);
+        void unlockPreview();
+};
+
+#endif //S2500_IMAGE_VIEWER_FRAMESTACKER_H
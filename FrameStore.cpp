@@ -0,0 +1,360 @@
+#include "FrameStore.h"
+#include "sem_capture_info.h"
+#include "sem_capture_pixels.h"
+#include "sem_frame_snapshot.h"
+#include "Logger.h"
+#include <cstdlib>
+
+FrameStore::~FrameStore() {
+    {
+        std::lock_guard<std::mutex> lock(spareMutex);
+        allocatorRunning = false;
+    }
+    sparesWanted.notify_all();
+    if (allocatorThread.joinable()) {
+        allocatorThread.join();
+    }
+    for (uint16_t *block : spares) {
+        free(block);
+    }
+    for (uint16_t *block : retired) {
+        free(block);
+    }
+    for (int i=0; i<bufferCount; i++) {
+        free(buffers[i].frame->pixels);
+        delete buffers[i].frame;
+    }
+}
+
+/**
+ * Sets up the buffers. Call before the decoder starts.
+ * @param width
+ * @param height
+ * @return The first back buffer, cleared, or nullptr if there wasn't the memory for it
+ */
+uint16_t *FrameStore::allocate(uint16_t width, uint16_t height) {
+    size_t samples = (size_t)width * height;
+    uint16_t *block;
+
+    bandHeight = BandHeight(height);
+    for (int i=bufferCount; i<FRAME_STORE_BUFFERS; i++) {
+        block = (uint16_t*)calloc(samples, sizeof(uint16_t));
+        if (!block) {
+            Logger::Instance()->log("[ERROR] Unable to allocate %dx%d frame buffers", width, height);
+            return nullptr;
+        }
+        addBuffer(block, samples);
+    }
+    for (int i=0; i<bufferCount; i++) {
+        buffers[i].frame->width = width;
+        buffers[i].frame->height = height;
+    }
+    back = 0;
+    live = 0;
+    published = -1;
+    return buffers[back].frame->pixels;
+}
+
+/**
+ * Adds a buffer around a cleared block of pixels
+ * @return Its index, or -1 if there's no room for another
+ */
+int FrameStore::addBuffer(uint16_t *pixels, size_t samples) {
+    int index = bufferCount;
+    SEMFrameSnapshot *frame;
+
+    if (index >= FRAME_STORE_MAX_BUFFERS) {
+        return -1;
+    }
+    frame = new SEMFrameSnapshot();
+    frame->pixels = pixels;
+    frame->capacity = samples;
+    buffers[index].frame = frame;
+    buffers[index].pins = 0;
+    buffers[index].dirtyBands = 0;
+    bufferCount = index + 1;
+    return index;
+}
+
+/**
+ * A buffer that is neither back nor published and that no reader has pinned. Decoder thread only. Neither index
+ * points at it, so a reader pinning it now is one that read an index before it moved and will find out and let go.
+ * @return Its index, or -1
+ */
+int FrameStore::findFreeBuffer() {
+    int current = published.load();
+
+    for (int i=0; i<bufferCount; i++) {
+        if (i != back && i != current && buffers[i].pins.load() == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Called by the decoder on frame sync: publishes the frame in the back buffer, with the capture state it was scanned
+ * under, and moves on to a free buffer. If readers are holding every other buffer and no more can be added, the frame
+ * isn't published and the next one is scanned over it, at the same size. Never allocates or frees memory.
+ * @param captureInfo
+ * @param pixels
+ * @param width Of the next frame. Set back to the last one's if there aren't the buffers for the new size yet, or
+ * the frame had to be scanned over
+ * @param height
+ * @return The back buffer to scan the next frame into
+ */
+uint16_t *FrameStore::publish(const SEMCapture &captureInfo, const SEMCapturePixels &pixels, uint16_t *width,
+                              uint16_t *height) {
+    SEMFrameSnapshot *frame = buffers[back].frame;
+    size_t samples = (size_t)*width * *height;
+    size_t capacity;
+    uint16_t *block;
+    int next;
+
+    if ((*width != frame->width || *height != frame->height) && !sparesReady(samples)) {
+        *width = frame->width;
+        *height = frame->height;
+        samples = (size_t)*width * *height;
+    }
+
+    next = findFreeBuffer();
+    if (next < 0 && bufferCount < FRAME_STORE_MAX_BUFFERS) {
+        if (takeSpare(samples, &block, &capacity)) {
+            next = addBuffer(block, capacity);
+            Logger::Instance()->log("Readers are holding %d frames, added a frame buffer", bufferCount - 1);
+        } else {
+            wantSpares(samples, 1);
+        }
+    }
+    if (next >= 0 && buffers[next].frame->capacity < samples) {
+        if (takeSpare(samples, &block, &capacity)) {
+            std::lock_guard<std::mutex> lock(spareMutex);
+            retired.push_back(buffers[next].frame->pixels);
+            buffers[next].frame->pixels = block;
+            buffers[next].frame->capacity = capacity;
+            sparesWanted.notify_one();
+        } else {
+            // Left behind by an earlier size and not grown yet
+            wantSpares(samples, 1);
+            next = -1;
+        }
+    }
+    if (next < 0) {
+        framesHeldBack++;
+        justPublished = -1;
+        *width = frame->width;
+        *height = frame->height;
+        return frame->pixels;
+    }
+
+    frame->setCaptureState(captureInfo, pixels);
+    published.store(back);
+    justPublished = back;
+    framesPublished++;
+
+    frame = buffers[next].frame;
+    // Readers go by these while it's the live buffer; they're stamped again when it's published
+    frame->width = *width;
+    frame->height = *height;
+    bandHeight = BandHeight(*height);
+    // Whatever was dirty in here belongs to a frame that's long gone
+    buffers[next].dirtyBands = 0;
+    back = next;
+    live.store(back);
+    return frame->pixels;
+}
+
+/**
+ * Whether a frame of samples pixels can be scanned from now on: there's a spare ready for every buffer too small for
+ * it. If not, asks the allocator for them. Decoder thread only.
+ */
+bool FrameStore::sparesReady(size_t samples) {
+    size_t needed = 0;
+
+    for (int i=0; i<bufferCount; i++) {
+        if (buffers[i].frame->capacity < samples) {
+            needed++;
+        }
+    }
+    if (!needed) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(spareMutex);
+        if (spareCapacity >= samples && spares.size() >= needed) {
+            return true;
+        }
+    }
+    wantSpares(samples, needed);
+    return false;
+}
+
+/**
+ * @param samples
+ * @param pixels Receives a cleared block of at least samples pixels
+ * @param capacity And its size
+ * @return False if there's no spare that big ready
+ */
+bool FrameStore::takeSpare(size_t samples, uint16_t **pixels, size_t *capacity) {
+    std::lock_guard<std::mutex> lock(spareMutex);
+    if (spareCapacity < samples || spares.empty()) {
+        return false;
+    }
+    *pixels = spares.back();
+    *capacity = spareCapacity;
+    spares.pop_back();
+    if (sparesToMake > 0) {
+        sparesToMake--;
+    }
+    return true;
+}
+
+/**
+ * Asks the allocator thread to have count spares of at least samples pixels ready. Spares smaller than that are
+ * retired.
+ */
+void FrameStore::wantSpares(size_t samples, size_t count) {
+    {
+        std::lock_guard<std::mutex> lock(spareMutex);
+        if (samples > spareCapacity) {
+            spareCapacity = samples;
+            retired.insert(retired.end(), spares.begin(), spares.end());
+            spares.clear();
+        }
+        if (count > sparesToMake) {
+            sparesToMake = count;
+        }
+        if (!allocatorThread.joinable()) {
+            allocatorRunning = true;
+            allocatorThread = std::thread(&FrameStore::allocatorLoop, this);
+        }
+    }
+    sparesWanted.notify_one();
+}
+
+/**
+ * Frees retired blocks and clears new spares until there are as many as the decoder wants. If the memory can't be
+ * had, gives up on that size; the decoder stays where it is.
+ */
+void FrameStore::allocatorLoop() {
+    std::vector<uint16_t *> unwanted;
+    size_t failedCapacity = 0;
+    size_t capacity;
+    uint16_t *block;
+    bool make;
+
+    std::unique_lock<std::mutex> lock(spareMutex);
+    while (true) {
+        sparesWanted.wait(lock, [&] {
+            return !allocatorRunning || !retired.empty() ||
+                   (spares.size() < sparesToMake && spareCapacity != failedCapacity);
+        });
+        if (!allocatorRunning) {
+            break;
+        }
+        unwanted.swap(retired);
+        capacity = spareCapacity;
+        make = spares.size() < sparesToMake && capacity != failedCapacity;
+        lock.unlock();
+
+        for (uint16_t *old : unwanted) {
+            free(old);
+        }
+        unwanted.clear();
+        block = make ? (uint16_t*)calloc(capacity, sizeof(uint16_t)) : nullptr;
+
+        lock.lock();
+        if (make && !block) {
+            Logger::Instance()->log("[ERROR] Unable to allocate a frame buffer of %zu samples, staying at this size",
+                                    capacity);
+            failedCapacity = capacity;
+        } else if (block && capacity == spareCapacity) {
+            spares.push_back(block);
+        } else if (block) {
+            // The size went up while it was being cleared
+            retired.push_back(block);
+        }
+    }
+}
+
+/**
+ * Pins the frame publish() just published, for the decoder to hand on to a consumer that unpins it when it's done.
+ * The decoder is the only one that reuses buffers, so there's no race to lose. Decoder thread only.
+ * @return The frame, or nullptr if the last frame sync couldn't publish
+ */
+const SEMFrameSnapshot *FrameStore::pinJustPublished() {
+    if (justPublished < 0) {
+        return nullptr;
+    }
+    buffers[justPublished].pins.fetch_add(1);
+    return buffers[justPublished].frame;
+}
+
+/**
+ * Pins the buffer index refers to. The index is read again after the pin is taken: if it moved in between, the
+ * decoder may already have picked the buffer up for scanning, so the pin is dropped and we try again.
+ */
+const SEMFrameSnapshot *FrameStore::pin(std::atomic<int> &index) {
+    int i;
+
+    while (true) {
+        i = index.load();
+        if (i < 0) {
+            return nullptr;
+        }
+        buffers[i].pins.fetch_add(1);
+        if (index.load() == i) {
+            return buffers[i].frame;
+        }
+        buffers[i].pins.fetch_sub(1);
+    }
+}
+
+/**
+ * The latest complete frame, held until unpin()
+ * @return The frame, or nullptr if none has been published yet
+ */
+const SEMFrameSnapshot *FrameStore::pinPublished() {
+    return pin(published);
+}
+
+/**
+ * The buffer the decoder is scanning into, held until unpin(). Its rows change as they're read, so it's for the
+ * display only, and only its pixels and size mean anything: the rest is left over from whichever frame used it last.
+ */
+const SEMFrameSnapshot *FrameStore::pinLive() {
+    return pin(live);
+}
+
+void FrameStore::unpin(const SEMFrameSnapshot *frame) {
+    for (int i=0; i<bufferCount; i++) {
+        if (buffers[i].frame == frame) {
+            buffers[i].pins.fetch_sub(1);
+            return;
+        }
+    }
+}
+
+/**
+ * @param frame A pinned frame
+ * @return The bands of rows the decoder has written to it since the last call
+ */
+uint64_t FrameStore::takeDirtyBands(const SEMFrameSnapshot *frame) {
+    for (int i=0; i<bufferCount; i++) {
+        if (buffers[i].frame == frame) {
+            return buffers[i].dirtyBands.exchange(0, std::memory_order_acquire);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return Rows per dirty band of a frame height rows high
+ */
+int32_t FrameStore::BandHeight(uint16_t height) {
+    return height > DIRTY_BANDS ? (height + DIRTY_BANDS - 1) / DIRTY_BANDS : 1;
+}
+
+int FrameStore::getBufferCount() {
+    return bufferCount;
+}
@@ -0,0 +1,96 @@
+#ifndef S2500_IMAGE_VIEWER_FRAMESTORE_H
+#define S2500_IMAGE_VIEWER_FRAMESTORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define FRAME_STORE_BUFFERS     3   // back, published, and one for a reader to hold on to
+#define FRAME_STORE_MAX_BUFFERS 8   // more are added while readers hold frames
+#define DIRTY_BANDS             64  // one bit per band in a buffer's dirtyBands
+
+struct SEMCapture;
+struct SEMCapturePixels;
+struct SEMFrameSnapshot;
+
+/**
+ * Multi-buffered frame store. The decoder scans into a back buffer; on frame sync publish() stamps it with the
+ * capture state and makes it the published frame with a single atomic store, then moves on to a buffer no reader is
+ * holding. Readers pin the published frame, or the live one still being scanned, without taking a lock: a pin is a
+ * reference count the decoder checks before it reuses a buffer, so a pinned published frame never changes under its
+ * reader.
+ *
+ * The live buffer is for the display only: its rows change while they're read. Everything that needs a whole,
+ * consistent frame reads the published one.
+ *
+ * The frame size can change at any frame sync. Buffers are a pool that only grows: one too small for the next frame is
+ * given a bigger block when it comes round to be scanned into, and never shrunk, so switching between scan speeds
+ * settles down to no allocations at all. The decoder never allocates or frees a block itself: an allocator thread
+ * clears spare blocks ahead of time and frees the ones they replace. Until there's a spare for every buffer that
+ * needs one, the decoder carries on at the old size, and a buffer added for readers that has no spare yet holds the
+ * frame back.
+ */
+class FrameStore {
+    private:
+        struct Buffer {
+            SEMFrameSnapshot *frame = nullptr;
+            std::atomic<uint32_t> pins{0};
+            std::atomic<uint64_t> dirtyBands{0};    // rows the decoder wrote that the display hasn't taken
+        };
+
+        Buffer buffers[FRAME_STORE_MAX_BUFFERS];
+        std::atomic<int> bufferCount{0};
+        std::atomic<int> published{-1};
+        std::atomic<int> live{0};
+        int back = 0;                               // owned by the decoder
+        int justPublished = -1;                     // by the last publish(), or -1. Owned by the decoder
+        int32_t bandHeight = 1;                     // of the back buffer. Owned by the decoder
+
+        std::thread allocatorThread;                // started the first time a spare is wanted
+        std::mutex spareMutex;
+        std::condition_variable sparesWanted;
+        std::vector<uint16_t *> spares;             // cleared blocks of spareCapacity samples, guarded by spareMutex
+        std::vector<uint16_t *> retired;            // blocks replaced by spares, for the allocator to free
+        size_t spareCapacity = 0;
+        size_t sparesToMake = 0;                    // spares the decoder is waiting for
+        bool allocatorRunning = false;
+
+        int addBuffer(uint16_t *pixels, size_t samples);
+        int findFreeBuffer();
+        bool sparesReady(size_t samples);
+        bool takeSpare(size_t samples, uint16_t **pixels, size_t *capacity);
+        void wantSpares(size_t samples, size_t count);
+        void allocatorLoop();
+        const SEMFrameSnapshot *pin(std::atomic<int> &index);
+
+    public:
+        std::atomic<uint32_t> framesPublished{0};
+        std::atomic<uint32_t> framesHeldBack{0};    // not published because readers held every other buffer
+
+        ~FrameStore();
+        uint16_t *allocate(uint16_t width, uint16_t height);
+        uint16_t *publish(const SEMCapture &captureInfo, const SEMCapturePixels &pixels, uint16_t *width,
+                          uint16_t *height);
+        const SEMFrameSnapshot *pinJustPublished();
+        const SEMFrameSnapshot *pinPublished();
+        const SEMFrameSnapshot *pinLive();
+        void unpin(const SEMFrameSnapshot *frame);
+        uint64_t takeDirtyBands(const SEMFrameSnapshot *frame);
+        static int32_t BandHeight(uint16_t height);
+        int getBufferCount();
+
+        void markRowDirty(int32_t row) {
+            std::atomic<uint64_t> &dirtyBands = buffers[back].dirtyBands;
+            uint64_t bit = 1ull << (row / bandHeight);
+            // Most rows land in a band that's already dirty; skip the atomic RMW for those
+            if (!(dirtyBands.load(std::memory_order_relaxed) & bit)) {
+                dirtyBands.fetch_or(bit, std::memory_order_release);
+            }
+        }
+};
+
+#endif //S2500_IMAGE_VIEWER_FRAMESTORE_H
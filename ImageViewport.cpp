@@ -0,0 +1,106 @@
+#include "ImageViewport.h"
+#include "LiveImageShader.h"
+#include "TiledTexture.h"
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Draws the image into the rest of the window through shader, with a toolbar underneath, and handles the mouse
+ * @param texture
+ * @param shader Installed around the image
+ */
+void ImageViewport::draw(TiledTexture &texture, LiveImageShader *shader) {
+    ImGuiIO &io = ImGui::GetIO();
+    int width = texture.getWidth();
+    int height = texture.getHeight();
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImVec2 size = ImGui::GetContentRegionAvail();
+
+    size.x = std::max(size.x, 64.0f);
+    size.y = std::max(size.y - ImGui::GetFrameHeightWithSpacing(), 64.0f);
+    ImVec2 viewCentre(origin.x + size.x * 0.5f, origin.y + size.y * 0.5f);
+
+    ImGui::InvisibleButton("image", size, ImGuiButtonFlags_MouseButtonLeft | ImGuiButtonFlags_MouseButtonMiddle);
+    bool hovered = ImGui::IsItemHovered();
+    if (hovered && ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left)) {
+        fit = true;
+    } else if (ImGui::IsItemActive() && (io.MouseDelta.x != 0.0f || io.MouseDelta.y != 0.0f)) {
+        centreX -= io.MouseDelta.x / zoom;
+        centreY -= io.MouseDelta.y / zoom;
+        fit = false;
+    }
+    if (hovered && io.MouseWheel != 0.0f) {
+        zoomAbout(zoom * std::pow(VIEWPORT_WHEEL_STEP, io.MouseWheel), io.MousePos, viewCentre);
+    }
+    if (fit) {
+        zoom = std::min(size.x / width, size.y / height);
+        centreX = width * 0.5f;
+        centreY = height * 0.5f;
+    }
+    // Panning stops with an edge of the image in the middle of the view
+    centreX = std::min(std::max(centreX, 0.0f), (float)width);
+    centreY = std::min(std::max(centreY, 0.0f), (float)height);
+
+    // Each tile is a quad; the clip rect leaves the GPU to draw only what's in view. Black where nothing has been
+    // uploaded yet
+    ImVec2 viewMax(origin.x + size.x, origin.y + size.y);
+    ImVec2 imageMin(viewCentre.x - centreX * zoom, viewCentre.y - centreY * zoom);
+    ImVec2 imageMax(imageMin.x + width * zoom, imageMin.y + height * zoom);
+    drawList->PushClipRect(origin, viewMax, true);
+    drawList->AddRectFilled(imageMin, imageMax, IM_COL32_BLACK);
+    drawList->AddCallback(LiveImageShader::Bind, shader);
+    for (int row=0; row<texture.getRows(); row++) {
+        for (int column=0; column<texture.getColumns(); column++) {
+            GLuint tile = texture.getTile(column, row);
+            float x = (float)column * TEXTURE_TILE_SIZE;
+            float y = (float)row * TEXTURE_TILE_SIZE;
+            ImVec2 tileMin(imageMin.x + x * zoom, imageMin.y + y * zoom);
+            ImVec2 tileMax(imageMin.x + std::min(x + TEXTURE_TILE_SIZE, (float)width) * zoom,
+                           imageMin.y + std::min(y + TEXTURE_TILE_SIZE, (float)height) * zoom);
+            bool outOfView = tileMax.x < origin.x || tileMax.y < origin.y || tileMin.x > viewMax.x ||
+                             tileMin.y > viewMax.y;
+            if (!tile || outOfView) {
+                continue;
+            }
+            drawList->AddImage((void*)(intptr_t)tile, tileMin, tileMax);
+        }
+    }
+    drawList->AddCallback(ImDrawCallback_ResetRenderState, nullptr);
+    drawList->PopClipRect();
+    texture.setMagFilter(zoom >= VIEWPORT_NEAREST_ZOOM ? GL_NEAREST : GL_LINEAR);
+
+    if (ImGui::Button("Fit")) {
+        fit = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("1:1")) {
+        zoomAbout(1.0f, viewCentre, viewCentre);
+    }
+    ImGui::SameLine();
+    ImGui::Text("%.1f%%", zoom * 100.0f);
+    if (hovered) {
+        int x = (int)std::floor((io.MousePos.x - imageMin.x) / zoom);
+        int y = (int)std::floor((io.MousePos.y - imageMin.y) / zoom);
+        if (x >= 0 && x < width && y >= 0 && y < height) {
+            ImGui::SameLine();
+            ImGui::Text("\t%d, %d", x, y);
+        }
+    }
+}
+
+/**
+ * Zooms to newZoom, keeping the image point under point where it is
+ * @param newZoom Clamped to VIEWPORT_MIN_ZOOM to VIEWPORT_MAX_ZOOM
+ * @param point Screen position
+ * @param viewCentre Screen position of the middle of the view
+ */
+void ImageViewport::zoomAbout(float newZoom, ImVec2 point, ImVec2 viewCentre) {
+    float x = centreX + (point.x - viewCentre.x) / zoom;
+    float y = centreY + (point.y - viewCentre.y) / zoom;
+
+    zoom = std::min(std::max(newZoom, VIEWPORT_MIN_ZOOM), VIEWPORT_MAX_ZOOM);
+    centreX = x - (point.x - viewCentre.x) / zoom;
+    centreY = y - (point.y - viewCentre.y) / zoom;
+    fit = false;
+}
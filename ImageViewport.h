@@ -0,0 +1,33 @@
+#ifndef S2500_IMAGE_VIEWER_IMAGEVIEWPORT_H
+#define S2500_IMAGE_VIEWER_IMAGEVIEWPORT_H
+
+#include "imgui/imgui.h"
+
+#define VIEWPORT_MIN_ZOOM       (1.0f / 64.0f)
+#define VIEWPORT_MAX_ZOOM       32.0f
+#define VIEWPORT_WHEEL_STEP     1.25f   // zoom per notch of the mouse wheel
+#define VIEWPORT_NEAREST_ZOOM   2.0f    // zoomed in this far, pixels are drawn as squares rather than interpolated
+
+class LiveImageShader;
+class TiledTexture;
+
+/**
+ * Pan and zoom view of a TiledTexture, filling the rest of the window it's drawn in. The mouse wheel zooms about
+ * the pointer, dragging with the left or middle button pans, and a double click (or "Fit") goes back to fitting the
+ * whole image in the view, which it keeps doing as the window is resized until the view is zoomed or panned again.
+ * Only the tiles in view are drawn; zoomed out, their mip levels keep the image from aliasing.
+ */
+class ImageViewport {
+    private:
+        float zoom = 1.0f;          // screen pixels per image pixel
+        float centreX = 0.0f;       // image point at the middle of the view
+        float centreY = 0.0f;
+        bool fit = true;
+
+        void zoomAbout(float newZoom, ImVec2 point, ImVec2 viewCentre);
+
+    public:
+        void draw(TiledTexture &texture, LiveImageShader *shader);
+};
+
+#endif //S2500_IMAGE_VIEWER_IMAGEVIEWPORT_H
@@ -0,0 +1,233 @@
+#include "LiveImageShader.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cmath>
+
+static const char *vertexShaderSource =
+    "#version 330 core\n"
+    "uniform mat4 ProjMtx;\n"
+    "in vec2 Position;\n"
+    "in vec2 UV;\n"
+    "in vec4 Color;\n"
+    "out vec2 Frag_UV;\n"
+    "void main() {\n"
+    "    Frag_UV = UV;\n"
+    "    gl_Position = ProjMtx * vec4(Position.xy, 0, 1);\n"
+    "}\n";
+
+// Black and Range are normalized like the texture, i.e. raw / 65535. The LUT is sampled at texel centres
+static const char *fragmentShaderSource =
+    "#version 330 core\n"
+    "uniform sampler2D Texture;\n"
+    "uniform sampler2D Lut;\n"
+    "uniform float Black;\n"
+    "uniform float Range;\n"
+    "uniform float InverseGamma;\n"
+    "uniform int Clipping;\n"
+    "in vec2 Frag_UV;\n"
+    "out vec4 Out_Color;\n"
+    "void main() {\n"
+    "    float t = (texture(Texture, Frag_UV).r - Black) / Range;\n"
+    "    if (Clipping != 0 && (t < 0.0 || t > 1.0)) {\n"
+    "        Out_Color = t < 0.0 ? vec4(0.0, 0.3, 1.0, 1.0) : vec4(1.0, 0.0, 0.0, 1.0);\n"
+    "        return;\n"
+    "    }\n"
+    "    t = pow(clamp(t, 0.0, 1.0), InverseGamma);\n"
+    "    Out_Color = vec4(texture(Lut, vec2(t * 255.0 / 256.0 + 0.5 / 256.0, 0.5)).rgb, 1.0);\n"
+    "}\n";
+
+static GLuint CompileShader(GLenum type, const char *source) {
+    GLint status = 0;
+    char infoLog[512];
+    GLuint shader = glCreateShader(type);
+
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        glGetShaderInfoLog(shader, sizeof(infoLog), nullptr, infoLog);
+        Logger::Instance()->log("[ERROR] Live image shader failed to compile: %s", infoLog);
+    }
+    return shader;
+}
+
+/**
+ * Links the program against the vertex attribute locations ImGui's own program uses, since the ImGui backend has
+ * already bound its vertex layout by the time the callback runs.
+ * @param imguiProgram
+ * @return True if the program linked
+ */
+bool LiveImageShader::link(GLint imguiProgram) {
+    GLint status = 0;
+    char infoLog[512];
+    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, vertexShaderSource);
+    GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
+
+    program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glBindAttribLocation(program, glGetAttribLocation(imguiProgram, "Position"), "Position");
+    glBindAttribLocation(program, glGetAttribLocation(imguiProgram, "UV"), "UV");
+    glBindAttribLocation(program, glGetAttribLocation(imguiProgram, "Color"), "Color");
+    glLinkProgram(program);
+    glDetachShader(program, vertexShader);
+    glDetachShader(program, fragmentShader);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        glGetProgramInfoLog(program, sizeof(infoLog), nullptr, infoLog);
+        Logger::Instance()->log("[ERROR] Live image shader failed to link: %s", infoLog);
+        glDeleteProgram(program);
+        program = 0;
+        return false;
+    }
+
+    projMtxLocation = glGetUniformLocation(program, "ProjMtx");
+    textureLocation = glGetUniformLocation(program, "Texture");
+    lutLocation = glGetUniformLocation(program, "Lut");
+    blackLocation = glGetUniformLocation(program, "Black");
+    rangeLocation = glGetUniformLocation(program, "Range");
+    inverseGammaLocation = glGetUniformLocation(program, "InverseGamma");
+    clippingLocation = glGetUniformLocation(program, "Clipping");
+    return true;
+}
+
+/**
+ * (Re)builds the colour map texture for colourMap. Leaves texture unit 1 active.
+ */
+void LiveImageShader::uploadLut() {
+    uint8_t rgba[LIVE_IMAGE_LUT_SIZE * 4];
+
+    FillLut(colourMap, rgba);
+    glActiveTexture(GL_TEXTURE1);
+    if (!lutTexture) {
+        glGenTextures(1, &lutTexture);
+        glBindTexture(GL_TEXTURE_2D, lutTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, lutTexture);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, LIVE_IMAGE_LUT_SIZE, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    lutColourMap = colourMap;
+}
+
+/**
+ * Fills rgba with LIVE_IMAGE_LUT_SIZE RGBA entries of colourMap, from the bottom of the window to the top
+ */
+void LiveImageShader::FillLut(ColourMap colourMap, uint8_t *rgba) {
+    float r;
+    float g;
+    float b;
+
+    for (int i=0; i<LIVE_IMAGE_LUT_SIZE; i++) {
+        float t = i / (float)(LIVE_IMAGE_LUT_SIZE - 1);
+        switch (colourMap) {
+            case COLOUR_MAP_INVERTED:
+                r = g = b = 1.0f - t;
+                break;
+            case COLOUR_MAP_HOT:
+                r = std::min(1.0f, 3.0f * t);
+                g = std::min(1.0f, std::max(0.0f, 3.0f * t - 1.0f));
+                b = std::max(0.0f, 3.0f * t - 2.0f);
+                break;
+            case COLOUR_MAP_RAINBOW: {
+                // Hue from blue (240 degrees) down to red
+                float h = (1.0f - t) * 4.0f;
+                float x = 1.0f - std::fabs(std::fmod(h, 2.0f) - 1.0f);
+                r = h < 1.0f ? 1.0f : h < 2.0f ? x : 0.0f;
+                g = h < 1.0f ? x : h < 3.0f ? 1.0f : x;
+                b = h < 2.0f ? 0.0f : h < 3.0f ? x : 1.0f;
+                break;
+            }
+            default:
+                r = g = b = t;
+                break;
+        }
+        rgba[i * 4 + 0] = (uint8_t)std::lround(r * 255.0f);
+        rgba[i * 4 + 1] = (uint8_t)std::lround(g * 255.0f);
+        rgba[i * 4 + 2] = (uint8_t)std::lround(b * 255.0f);
+        rgba[i * 4 + 3] = 255;
+    }
+}
+
+void LiveImageShader::destroy() {
+    if (program) {
+        glDeleteProgram(program);
+        program = 0;
+    }
+    if (lutTexture) {
+        glDeleteTextures(1, &lutTexture);
+        lutTexture = 0;
+        lutColourMap = COLOUR_MAPS;
+    }
+}
+
+/**
+ * Sets the window: a raw sample of black is drawn as the bottom of the colour map and one of white as the top
+ */
+void LiveImageShader::setWindow(float black, float white) {
+    this->black = black;
+    this->white = white;
+}
+
+/**
+ * ImDrawCallback that switches the ImGui render state over to this shader. userCallbackData must be the
+ * LiveImageShader. The ImGui program is left bound (and the image drawn as-is) if the shader can't be built.
+ */
+void LiveImageShader::Bind(const ImDrawList *drawList, const ImDrawCmd *cmd) {
+    LiveImageShader *shader = static_cast<LiveImageShader *>(cmd->UserCallbackData);
+    ImDrawData *drawData = ImGui::GetDrawData();
+    GLint imguiProgram = 0;
+
+    if (!shader->program) {
+        if (shader->linkFailed) {
+            return;
+        }
+        glGetIntegerv(GL_CURRENT_PROGRAM, &imguiProgram);
+        if (!shader->link(imguiProgram)) {
+            shader->linkFailed = true;
+            return;
+        }
+    }
+
+    // Same orthographic projection the ImGui backend sets up
+    float L = drawData->DisplayPos.x;
+    float R = drawData->DisplayPos.x + drawData->DisplaySize.x;
+    float T = drawData->DisplayPos.y;
+    float B = drawData->DisplayPos.y + drawData->DisplaySize.y;
+    const float orthoProjection[4][4] = {
+        { 2.0f/(R-L),   0.0f,         0.0f,   0.0f },
+        { 0.0f,         2.0f/(T-B),   0.0f,   0.0f },
+        { 0.0f,         0.0f,        -1.0f,   0.0f },
+        { (R+L)/(L-R),  (T+B)/(B-T),  0.0f,   1.0f },
+    };
+
+    float range = shader->white - shader->black;
+    if (std::fabs(range) < 1.0f) {
+        range = range < 0.0f ? -1.0f : 1.0f;
+    }
+
+    if (shader->lutColourMap != shader->colourMap) {
+        shader->uploadLut();
+    } else {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, shader->lutTexture);
+    }
+    // ImGui binds the image's texture to whichever unit is active
+    glActiveTexture(GL_TEXTURE0);
+
+    glUseProgram(shader->program);
+    glUniformMatrix4fv(shader->projMtxLocation, 1, GL_FALSE, &orthoProjection[0][0]);
+    glUniform1i(shader->textureLocation, 0);
+    glUniform1i(shader->lutLocation, 1);
+    glUniform1f(shader->blackLocation, shader->black / 65535.0f);
+    glUniform1f(shader->rangeLocation, range / 65535.0f);
+    glUniform1f(shader->inverseGammaLocation, 1.0f / (shader->gamma > 0.01f ? shader->gamma : 0.01f));
+    glUniform1i(shader->clippingLocation, shader->colourMap == COLOUR_MAP_CLIPPING);
+}
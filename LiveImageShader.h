@@ -0,0 +1,60 @@
+#ifndef S2500_IMAGE_VIEWER_LIVEIMAGESHADER_H
+#define S2500_IMAGE_VIEWER_LIVEIMAGESHADER_H
+
+#include <glad/glad.h>
+#include "imgui/imgui.h"
+
+#define LIVE_IMAGE_LUT_SIZE 256
+
+enum ColourMap {
+    COLOUR_MAP_GRAY,
+    COLOUR_MAP_INVERTED,
+    COLOUR_MAP_HOT,         // black, red, yellow, white
+    COLOUR_MAP_RAINBOW,
+    COLOUR_MAP_CLIPPING,    // grayscale, with samples below the window blue and above it red
+    COLOUR_MAPS,
+};
+
+/**
+ * Draws the single-channel R16 live texture through a transfer function on the GPU: raw samples are windowed
+ * between black and white, raised to 1/gamma, and looked up in a colour map. Nothing is baked into the pixels, so
+ * changing any of it applies to the whole frame at once and costs no CPU. Installed around ImGui::Image() with
+ * ImDrawList callbacks:
+ *
+ *     drawList->AddCallback(LiveImageShader::Bind, &shader);
+ *     ImGui::Image(...);
+ *     drawList->AddCallback(ImDrawCallback_ResetRenderState, nullptr);
+ *
+ * Uses only GLSL 3.30 and plain 2D textures, so it runs on Mesa's software rasterizers too.
+ */
+class LiveImageShader {
+    private:
+        GLuint program = 0;
+        GLuint lutTexture = 0;
+        ColourMap lutColourMap = COLOUR_MAPS;   // the map lutTexture holds
+        GLint projMtxLocation = -1;
+        GLint textureLocation = -1;
+        GLint lutLocation = -1;
+        GLint blackLocation = -1;
+        GLint rangeLocation = -1;
+        GLint inverseGammaLocation = -1;
+        GLint clippingLocation = -1;
+        bool linkFailed = false;
+
+        bool link(GLint imguiProgram);
+        void uploadLut();
+
+    public:
+        // Window, in raw sample units: black is drawn as the bottom of the colour map, white as the top
+        float black = 0.0f;
+        float white = 8191.0f;
+        float gamma = 1.0f;
+        ColourMap colourMap = COLOUR_MAP_GRAY;
+
+        void destroy();
+        void setWindow(float black, float white);
+        static void Bind(const ImDrawList *drawList, const ImDrawCmd *cmd);
+        static void FillLut(ColourMap colourMap, uint8_t *rgba);
+};
+
+#endif //S2500_IMAGE_VIEWER_LIVEIMAGESHADER_H
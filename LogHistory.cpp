@@ -0,0 +1,71 @@
+#include "LogHistory.h"
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+LogHistory::LogHistory() {
+    entries = (LogEntry *)calloc(LOG_HISTORY_ENTRIES, sizeof(LogEntry));
+}
+
+LogHistory::~LogHistory() {
+    free(entries);
+}
+
+/**
+ * Adds one message, overwriting the oldest once the ring is full
+ * @param text The message without its timestamp or newline. Needn't be null-terminated
+ */
+void LogHistory::append(int64_t timestampNanoseconds, LogSeverity severity, const char *text, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    LogEntry &entry = entries[total & (LOG_HISTORY_ENTRIES - 1)];
+
+    if (length > LOG_ENTRY_TEXT_BYTES - 1) {
+        length = LOG_ENTRY_TEXT_BYTES - 1;
+    }
+    entry.timestampNanoseconds = timestampNanoseconds;
+    entry.severity = severity;
+    entry.length = (uint16_t)length;
+    memcpy(entry.text, text, length);
+    entry.text[length] = '\0';
+    total++;
+}
+
+/**
+ * Copies an entry out
+ * @return False if index has been overwritten or hasn't been logged yet
+ */
+bool LogHistory::get(uint64_t index, LogEntry &entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (index >= total || total - index > LOG_HISTORY_ENTRIES) {
+        return false;
+    }
+    entry = entries[index & (LOG_HISTORY_ENTRIES - 1)];
+    return true;
+}
+
+uint64_t LogHistory::getOldest() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return total > LOG_HISTORY_ENTRIES ? total - LOG_HISTORY_ENTRIES : 0;
+}
+
+/**
+ * Appends the numbers of entries from index from onwards that pass the filter to matches, so a viewer can keep its
+ * filtered list up to date by only looking at what's new. Entries already overwritten are skipped.
+ * @param severityMask Bit n set lets LogSeverity n through
+ * @param search Case-insensitive substring to look for, or empty for everything
+ * @return The number to pass as from next time
+ */
+uint64_t LogHistory::match(uint64_t from, uint32_t severityMask, const char *search, std::deque<uint64_t> &matches) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t oldest = total > LOG_HISTORY_ENTRIES ? total - LOG_HISTORY_ENTRIES : 0;
+
+    for (uint64_t i=from > oldest ? from : oldest; i<total; i++) {
+        const LogEntry &entry = entries[i & (LOG_HISTORY_ENTRIES - 1)];
+        if ((severityMask & (1u << entry.severity)) && (!search[0] || strcasestr(entry.text, search))) {
+            matches.push_back(i);
+        }
+    }
+    return total;
+}
@@ -0,0 +1,47 @@
+#ifndef S2500_IMAGE_VIEWER_LOGHISTORY_H
+#define S2500_IMAGE_VIEWER_LOGHISTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+#define LOG_HISTORY_ENTRIES     65536   // power of two
+#define LOG_ENTRY_TEXT_BYTES    224     // longer messages are cut short here; the log file has them whole
+
+enum LogSeverity : uint8_t {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARNING,
+    LOG_ERROR,
+    LOG_SEVERITIES,
+};
+
+struct LogEntry {
+    int64_t timestampNanoseconds;
+    LogSeverity severity;
+    uint16_t length;
+    char text[LOG_ENTRY_TEXT_BYTES];
+};
+
+/**
+ * The last LOG_HISTORY_ENTRIES formatted log messages, for the log window. Entries are numbered from 0 in the order
+ * they were logged; once the ring wraps, the oldest are overwritten and their numbers are no longer valid. The
+ * Logger's flusher thread is the only writer.
+ */
+class LogHistory {
+    private:
+        LogEntry *entries;
+        uint64_t total = 0;                 // entries ever appended
+        std::mutex mutex;
+
+    public:
+        LogHistory();
+        ~LogHistory();
+        void append(int64_t timestampNanoseconds, LogSeverity severity, const char *text, size_t length);
+        bool get(uint64_t index, LogEntry &entry);
+        uint64_t getOldest();
+        uint64_t match(uint64_t from, uint32_t severityMask, const char *search, std::deque<uint64_t> &matches);
+};
+
+#endif //S2500_IMAGE_VIEWER_LOGHISTORY_H
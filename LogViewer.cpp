@@ -0,0 +1,90 @@
+#include "LogViewer.h"
+#include <ctime>
+#include "imgui/imgui.h"
+
+static const char *severityNames[LOG_SEVERITIES] = { "Debug", "Info", "Warning", "Error" };
+static const ImVec4 severityColours[LOG_SEVERITIES] = {
+    ImVec4(0.55f, 0.55f, 0.55f, 1.0f),
+    ImVec4(0.90f, 0.90f, 0.90f, 1.0f),
+    ImVec4(1.00f, 0.80f, 0.30f, 1.0f),
+    ImVec4(1.00f, 0.40f, 0.40f, 1.0f),
+};
+
+LogViewer::LogViewer(LogHistory &history) : history(history) {
+}
+
+/**
+ * Starts the filtered list over, after the filter changed
+ */
+void LogViewer::refilter() {
+    matches.clear();
+    scanned = 0;
+}
+
+void LogViewer::draw(bool *open) {
+    ImGui::SetNextWindowSize(ImVec2(700, 400), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Log window", open)) {
+        ImGui::End();
+        return;
+    }
+
+    for (int severity=LOG_SEVERITIES - 1; severity>=0; severity--) {
+        if (ImGui::CheckboxFlags(severityNames[severity], &severityMask, 1u << severity)) {
+            refilter();
+        }
+        ImGui::SameLine();
+    }
+    ImGui::SetNextItemWidth(200);
+    if (ImGui::InputTextWithHint("##search", "Search", search, sizeof(search))) {
+        refilter();
+    }
+    ImGui::SameLine();
+    ImGui::Checkbox("Follow", &followTail);
+
+    // Bring the list up to date, and forget entries the history has overwritten
+    scanned = history.match(scanned, severityMask, search, matches);
+    uint64_t oldest = history.getOldest();
+    while (!matches.empty() && matches.front() < oldest) {
+        matches.pop_front();
+    }
+    ImGui::Text("%zu lines", matches.size());
+
+    ImGui::BeginChild("Log lines", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar);
+    ImGuiListClipper clipper;
+    LogEntry entry;
+    char timestamp[16];
+    clipper.Begin((int)matches.size());
+    while (clipper.Step()) {
+        for (int row=clipper.DisplayStart; row<clipper.DisplayEnd; row++) {
+            if (!history.get(matches[row], entry)) {
+                ImGui::TextDisabled("(overwritten)");
+                continue;
+            }
+            std::time_t seconds = entry.timestampNanoseconds / 1000000000;
+            std::tm local;
+            localtime_r(&seconds, &local);
+            strftime(timestamp, sizeof(timestamp), "%T", &local);
+            ImGui::TextDisabled("%s", timestamp);
+            ImGui::SameLine();
+            ImGui::PushStyleColor(ImGuiCol_Text, severityColours[entry.severity]);
+            ImGui::TextUnformatted(entry.text, entry.text + entry.length);
+            ImGui::PopStyleColor();
+        }
+    }
+    clipper.End();
+    // Stop following when the user scrolls up; start again when they're back at the bottom
+    bool userScrolled = ImGui::GetIO().MouseWheel > 0.0f || ImGui::IsMouseDragging(ImGuiMouseButton_Left);
+    if (ImGui::GetScrollY() < ImGui::GetScrollMaxY()) {
+        if (ImGui::IsWindowHovered() && userScrolled) {
+            followTail = false;
+        }
+    } else if (ImGui::GetScrollMaxY() > 0.0f) {
+        followTail = true;
+    }
+    if (followTail) {
+        ImGui::SetScrollHereY(1.0f);
+    }
+    ImGui::EndChild();
+
+    ImGui::End();
+}
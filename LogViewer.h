@@ -0,0 +1,29 @@
+#ifndef S2500_IMAGE_VIEWER_LOGVIEWER_H
+#define S2500_IMAGE_VIEWER_LOGVIEWER_H
+
+#include <cstdint>
+#include <deque>
+#include "LogHistory.h"
+
+/**
+ * The log window. Keeps the numbers of the history entries that pass the severity filter and search, adding only
+ * new entries each frame, and draws just the rows in view with ImGuiListClipper, so it costs the same with a full
+ * history as with an empty one.
+ */
+class LogViewer {
+    private:
+        LogHistory &history;
+        std::deque<uint64_t> matches;
+        uint64_t scanned = 0;               // history entries already run through the filter
+        uint32_t severityMask = ~(1u << LOG_DEBUG);
+        char search[128] = {0};
+        bool followTail = true;
+
+        void refilter();
+
+    public:
+        explicit LogViewer(LogHistory &history);
+        void draw(bool *open);
+};
+
+#endif //S2500_IMAGE_VIEWER_LOGVIEWER_H
@@ -1,13 +1,14 @@
 #include "Logger.h"
 #include <sys/stat.h>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
 #include <ctime>
 #include <unistd.h>
 #include <fcntl.h>
 #include <cstring>
-#include <cstdarg>
 
 Logger *Logger::m_pInstance = nullptr;
-int logfile;
 
 Logger *Logger::Instance() {
     if (!m_pInstance) {
@@ -16,49 +17,325 @@ Logger *Logger::Instance() {
     return m_pInstance;
 }
 
+Logger::Logger() {
+    ring = new LogRecord[LOG_RING_RECORDS];
+    for (size_t i=0; i<LOG_RING_RECORDS; i++) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    running = true;
+    flushThread = std::thread(&Logger::flushLoop, this);
+}
+
 void Logger::init() {
     char buffer[256];
     std::time_t t = std::time(nullptr);
-    std::tm *now = std::localtime(&t);
+    std::tm now;
     struct stat st = {0};
 
+    localtime_r(&t, &now);
     if (stat("logs", &st) == -1) {
         mkdir("logs", 0750);
     }
 
-    strftime(buffer, sizeof(buffer), "logs/%F_%T.log", now); // "2021-09-02_15:47:00.log"
+    strftime(buffer, sizeof(buffer), "logs/%F_%T.log", &now); // "2021-09-02_15:47:00.log"
     printf("Want to open %s\n", buffer);
-    logfile = open(buffer, O_CREAT | O_WRONLY, 0660);
-    if (logfile == -1) {
-        char msg[256];
-        snprintf(msg, sizeof(msg), "Unable to open log file %s!\n", buffer);
-        log(msg);
+    int fd = open(buffer, O_CREAT | O_WRONLY, 0660);
+    logfile = fd;
+    if (fd == -1) {
+        log("Unable to open log file %s!", buffer);
     }
 }
 
-void const Logger::log(const char *logFormat, ...) {
-    char buffer[256];
-    char msg[256];
-    std::time_t t = std::time(0);
-    std::tm *now = std::localtime(&t);
-    va_list vl;
-    char logString[256];
+int64_t Logger::Now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    va_start(vl, logFormat);
-    if (vsnprintf(logString, sizeof(logString), logFormat, vl) == -1) {
-        logString[sizeof(logString)-1] = '\0';
+/**
+ * Severity from the tag a message starts with. Untagged messages that report a failure count as errors; the rest are
+ * informational.
+ */
+LogSeverity Logger::Severity(const char *format) {
+    if (!strncmp(format, "[ERROR]", 7)) {
+        return LOG_ERROR;
+    } else if (!strncmp(format, "[WARN", 5)) {
+        return LOG_WARNING;
+    } else if (!strncmp(format, "[INFO]", 6)) {
+        return LOG_INFO;
+    } else if (!strncmp(format, "[DEBUG]", 7)) {
+        return LOG_DEBUG;
+    } else if (!strncmp(format, "Unable to", 9) || !strncmp(format, "Couldn't", 8)) {
+        return LOG_ERROR;
+    }
+    return LOG_INFO;
+}
+
+/**
+ * Per-call-site rate limit. The site table is open-addressed on the format pointer; a site that can't find a slot
+ * isn't limited.
+ * @return False if this call site has used up its messages for the current second
+ */
+bool Logger::admit(const char *format, int64_t now) {
+    uintptr_t hash = ((uintptr_t)format >> 3) * 0x9E3779B97F4A7C15ull;
+    int64_t second = now / 1000000000;
+    LogSite *site = nullptr;
+
+    for (uint32_t probe=0; probe<4; probe++) {
+        LogSite &candidate = sites[(hash + probe) & (LOG_SITES - 1)];
+        const char *owner = candidate.format.load(std::memory_order_relaxed);
+        if (owner == nullptr && candidate.format.compare_exchange_strong(owner, format)) {
+            owner = format;
+        }
+        if (owner == format) {
+            site = &candidate;
+            break;
+        }
+    }
+    if (!site) {
+        return true;
     }
-    va_end(vl);
 
-    strftime(buffer, sizeof(buffer), "%F %T", now); // "2021-09-02_15:47:00.log"
-    sprintf(msg, "%s: %s\n", buffer, logString);
-    printf("%s", msg);
+    int64_t siteSecond = site->second.load(std::memory_order_relaxed);
+    if (siteSecond != second && site->second.compare_exchange_strong(siteSecond, second)) {
+        site->count.store(0, std::memory_order_relaxed);
+    }
+    if (site->count.fetch_add(1, std::memory_order_relaxed) >= LOG_SITE_MESSAGES_PER_SECOND) {
+        site->suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Claims the next free slot in the ring (a bounded MPMC queue with a sequence number per slot, used here with a
+ * single consumer). A slot is free for position pos when its sequence equals pos.
+ * @return The slot to fill in, or nullptr if the ring is full
+ */
+LogRecord *Logger::acquire() {
+    size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    LogRecord *record;
+    intptr_t difference;
+
+    while (true) {
+        record = &ring[position & (LOG_RING_RECORDS - 1)];
+        difference = (intptr_t)record->sequence.load(std::memory_order_acquire) - (intptr_t)position;
+        if (difference == 0) {
+            if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                return record;
+            }
+        } else if (difference < 0) {
+            return nullptr;
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Hands a filled slot to the flusher
+ */
+void Logger::commit(LogRecord *record) {
+    size_t position = record->sequence.load(std::memory_order_relaxed);
+    record->sequence.store(position + 1, std::memory_order_release);
+}
+
+void Logger::flushLoop() {
+    std::string out;
+    int64_t lastReport = Now();
+    bool stopping;
 
-    write(logfile, msg, strlen(msg));
+    out.reserve(64 * 1024);
+    do {
+        stopping = !running.load();
+        drain(out);
+        if (Now() - lastReport >= 1000000000ll || stopping) {
+            lastReport = Now();
+            reportSuppressed(out, lastReport);
+        }
+        if (!out.empty()) {
+            fwrite(out.data(), 1, out.size(), stdout);
+            fflush(stdout);
+            int fd = logfile.load();
+            if (fd != -1) {
+                write(fd, out.data(), out.size());
+            }
+            out.clear();
+        }
+        if (!stopping) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+        }
+    } while (!stopping);
 }
 
+/**
+ * Formats every committed record onto out and frees their slots
+ * @return Records taken
+ */
+size_t Logger::drain(std::string &out) {
+    size_t count = 0;
+    LogRecord *record;
+
+    while (true) {
+        record = &ring[dequeuePosition & (LOG_RING_RECORDS - 1)];
+        if (record->sequence.load(std::memory_order_acquire) != dequeuePosition + 1) {
+            break;
+        }
+        formatRecord(*record, Severity(record->format), out);
+        record->sequence.store(dequeuePosition + LOG_RING_RECORDS, std::memory_order_release);
+        dequeuePosition++;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Adds a line for each call site that had messages rate-limited, and one for messages lost to a full ring
+ */
+void Logger::reportSuppressed(std::string &out, int64_t now) {
+    LogRecord note;
+    uint64_t lost = dropped.exchange(0);
+
+    note.timestampNanoseconds = now;
+    for (LogSite &site : sites) {
+        const char *format = site.format.load(std::memory_order_relaxed);
+        uint32_t suppressed = format ? site.suppressed.exchange(0) : 0;
+        if (suppressed) {
+            note.format = "(%u more like \"%s\" dropped)";
+            note.argCount = 0;
+            note.stringBytes = 0;
+            note.add(LOG_ARG_UNSIGNED, suppressed);
+            note.addString(format);
+            formatRecord(note, LOG_WARNING, out);
+        }
+    }
+    if (lost) {
+        note.format = "(%" PRIu64 " messages dropped, the log ring was full)";
+        note.argCount = 0;
+        note.stringBytes = 0;
+        note.add(LOG_ARG_UNSIGNED, (int64_t)lost);
+        formatRecord(note, LOG_WARNING, out);
+    }
+}
+
+/**
+ * Renders one record as "date time: message\n" onto out, and adds the message to the history. The format string is
+ * walked here and each conversion is handed to snprintf with the stored argument converted to what the conversion
+ * expects.
+ */
+void Logger::formatRecord(const LogRecord &record, LogSeverity severity, std::string &out) {
+    char piece[256];
+    char spec[32];
+    std::time_t seconds = record.timestampNanoseconds / 1000000000;
+    std::tm now;
+    const char *f = record.format;
+    uint8_t arg = 0;
+
+    localtime_r(&seconds, &now);
+    strftime(piece, sizeof(piece), "%F %T: ", &now);
+    out += piece;
+    size_t messageStart = out.size();
+
+    while (*f) {
+        if (*f != '%') {
+            const char *literal = f;
+            while (*f && *f != '%') {
+                f++;
+            }
+            out.append(literal, f - literal);
+            continue;
+        }
+        if (f[1] == '%') {
+            out += '%';
+            f += 2;
+            continue;
+        }
+
+        // %[flags][width][.precision][length]conversion
+        size_t length = strspn(f + 1, "-+ #0123456789.hljztL") + 1;
+        char conversion = f[length];
+        if (!conversion || length + 2 > sizeof(spec)) {
+            out += f;
+            break;
+        }
+        if (arg >= record.argCount) {
+            out.append(f, length + 1);
+            f += length + 1;
+            continue;
+        }
+        memcpy(spec, f, length);
+        spec[length] = '\0';
+
+        LogArgType type = record.types[arg];
+        auto value = record.args[arg++];
+        // Swap the caller's length modifier for the one matching how the argument is stored
+        spec[strcspn(spec, "hljztL")] = '\0';
+        switch (conversion) {
+            case 'd':
+            case 'i':
+                strncat(spec, "lld", sizeof(spec) - strlen(spec) - 1);
+                snprintf(piece, sizeof(piece), spec, type == LOG_ARG_DOUBLE ? (long long)value.d : (long long)value.i);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X': {
+                char suffix[4] = {'l', 'l', conversion, '\0'};
+                strncat(spec, suffix, sizeof(spec) - strlen(spec) - 1);
+                snprintf(piece, sizeof(piece), spec,
+                         type == LOG_ARG_DOUBLE ? (unsigned long long)value.d : (unsigned long long)value.u);
+                break;
+            }
+            case 'c':
+                piece[0] = (char)value.i;
+                piece[1] = '\0';
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A': {
+                char suffix[2] = {conversion, '\0'};
+                strncat(spec, suffix, sizeof(spec) - strlen(spec) - 1);
+                snprintf(piece, sizeof(piece), spec, type == LOG_ARG_DOUBLE ? value.d :
+                         type == LOG_ARG_UNSIGNED ? (double)value.u : (double)value.i);
+                break;
+            }
+            case 's':
+                strncat(spec, "s", sizeof(spec) - strlen(spec) - 1);
+                snprintf(piece, sizeof(piece), spec, type == LOG_ARG_STRING ? record.strings + value.offset : "(?)");
+                break;
+            case 'p':
+                snprintf(piece, sizeof(piece), "%p", value.p);
+                break;
+            default:
+                snprintf(piece, sizeof(piece), "%%%c?", conversion);
+                break;
+        }
+        out += piece;
+        f += length + 1;
+    }
+    history.append(record.timestampNanoseconds, severity, out.data() + messageStart, out.size() - messageStart);
+    out += '\n';
+}
+
+LogHistory &Logger::getHistory() {
+    return history;
+}
+
+/**
+ * Flushes what's queued and closes the log file. Messages logged after this are kept in the ring but not written.
+ */
 void Logger::quit() {
-    if (logfile != -1) {
-        close(logfile);
+    if (running.exchange(false)) {
+        flushThread.join();
     }
-}
\ No newline at end of file
+    int fd = logfile.exchange(-1);
+    if (fd != -1) {
+        close(fd);
+    }
+}
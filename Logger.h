@@ -1,20 +1,128 @@
 #ifndef S2500_IMAGE_VIEWER_LOGGER_H
 #define S2500_IMAGE_VIEWER_LOGGER_H
 
+#include <atomic>
+#include <cstdint>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include "log_record.h"
+#include "LogHistory.h"
 
+#define LOG_RING_RECORDS            4096    // power of two
+#define LOG_SITES                   256     // call sites tracked for rate limiting, power of two
+#define LOG_SITE_MESSAGES_PER_SECOND 20     // from any one call site; the rest are counted and dropped
+#define LOG_FLUSH_INTERVAL_MS       20
+
+/**
+ * log() doesn't format or write anything: it copies the format string pointer and the arguments into a LogRecord in
+ * a lock-free multi-producer ring and returns, so it's cheap enough for the decode thread. A background thread drains
+ * the ring every LOG_FLUSH_INTERVAL_MS, formats the messages and writes them out in one go to stdout and the log file.
+ *
+ * Each call site (format string) may log LOG_SITE_MESSAGES_PER_SECOND messages a second; past that they're dropped
+ * and the flusher reports how many. If the ring fills up, messages are dropped and counted too. log() never blocks.
+ *
+ * The flusher also keeps the last messages in a LogHistory for the log window, each with a severity taken from its
+ * "[ERROR]"/"[WARN]"/"[INFO]"/"[DEBUG]" tag, or from its wording if it has none.
+ */
 class Logger {
     private:
-        int logfile = -1;
-         Logger() = default;
+        struct LogSite {
+            std::atomic<const char *> format{nullptr};
+            std::atomic<int64_t> second{0};
+            std::atomic<uint32_t> count{0};
+            std::atomic<uint32_t> suppressed{0};
+        };
+
+        std::atomic<int> logfile{-1};       // set by init() while the flusher is already running
+        LogRecord *ring;
+        char pad0[64];
+        std::atomic<size_t> enqueuePosition{0};
+        char pad1[64];
+        size_t dequeuePosition = 0;         // owned by the flusher
+        LogSite sites[LOG_SITES];
+        std::atomic<uint64_t> dropped{0};
+        std::thread flushThread;
+        std::atomic<bool> running{false};
+        LogHistory history;
+
+         Logger();
         ~Logger() = default;
         static Logger *m_pInstance;
 
+        static int64_t Now();
+        static LogSeverity Severity(const char *format);
+        bool admit(const char *format, int64_t now);
+        LogRecord *acquire();
+        void commit(LogRecord *record);
+        void flushLoop();
+        size_t drain(std::string &out);
+        void reportSuppressed(std::string &out, int64_t now);
+        void formatRecord(const LogRecord &record, LogSeverity severity, std::string &out);
+
+        void pack(LogRecord &) {}
+
+        template<typename T, typename... Rest>
+        void pack(LogRecord &record, T value, Rest... rest) {
+            add(record, value);
+            pack(record, rest...);
+        }
+
+        template<typename T>
+        static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+        add(LogRecord &record, T value) {
+            record.add(std::is_signed<T>::value || std::is_enum<T>::value ? LOG_ARG_SIGNED : LOG_ARG_UNSIGNED,
+                       (int64_t)value);
+        }
+
+        template<typename T>
+        static typename std::enable_if<std::is_floating_point<T>::value>::type add(LogRecord &record, T value) {
+            record.add((double)value);
+        }
+
+        static void add(LogRecord &record, const char *value) {
+            record.addString(value);
+        }
+
+        static void add(LogRecord &record, char *value) {
+            record.addString(value);
+        }
+
+        template<typename T>
+        static void add(LogRecord &record, T *value) {
+            record.add((const void *)value);
+        }
+
     public:
         static Logger *Instance();
         void init();
         void quit();
-        void const log(const char *logFormat, ...);
+        LogHistory &getHistory();
+
+        /**
+         * Queues a printf-style message
+         * @param logFormat A string literal: it's only formatted later, on the flusher thread
+         */
+        template<typename... Args>
+        void log(const char *logFormat, Args... args) {
+            int64_t now = Now();
+            LogRecord *record;
+
+            if (!admit(logFormat, now)) {
+                return;
+            }
+            record = acquire();
+            if (!record) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            record->format = logFormat;
+            record->timestampNanoseconds = now;
+            record->argCount = 0;
+            record->stringBytes = 0;
+            pack(*record, args...);
+            commit(record);
+        }
 };
 
 #endif //S2500_IMAGE_VIEWER_LOGGER_H
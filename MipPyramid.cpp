@@ -0,0 +1,93 @@
+#include "MipPyramid.h"
+#include <algorithm>
+#include <cstdlib>
+
+MipPyramid::~MipPyramid() {
+    free(storage);
+}
+
+/**
+ * Sizes the levels for a width x height level 0, halving (rounding down) until the larger side is down to
+ * MIP_PYRAMID_SMALLEST. The levels below 0 start out black.
+ */
+void MipPyramid::allocate(int width, int height) {
+    size_t offset = 0;
+
+    free(storage);
+    levelCount = 0;
+    while (levelCount < MIP_PYRAMID_MAX_LEVELS) {
+        levels[levelCount] = {width, height, nullptr, offset, 0, 0};
+        offset += (size_t)width * height;
+        levelCount++;
+        if (std::max(width, height) <= MIP_PYRAMID_SMALLEST) {
+            break;
+        }
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    samples = offset;
+    storage = (uint16_t *)calloc(samples - levels[0].width * levels[0].height + 1, sizeof(uint16_t));
+    for (int i=1; i<levelCount; i++) {
+        levels[i].pixels = storage + (levels[i].offset - levels[1].offset);
+    }
+}
+
+/**
+ * Filters rows firstRow to firstRow + numRows - 1 of level 0 down through the other levels. Each level's firstRow and
+ * endRow are left at the rows that changed.
+ * @param pixels Level 0
+ */
+void MipPyramid::update(const uint16_t *pixels, int firstRow, int numRows) {
+    levels[0].pixels = pixels;
+    levels[0].firstRow = firstRow;
+    levels[0].endRow = firstRow + numRows;
+
+    for (int i=1; i<levelCount; i++) {
+        MipLevel &above = levels[i - 1];
+        MipLevel &level = levels[i];
+        level.firstRow = above.firstRow / 2;
+        level.endRow = std::min(level.height, (above.endRow + 1) / 2);
+        if (level.firstRow >= level.endRow) {
+            // Only the odd row left over at the bottom of an odd-height level changed
+            level.endRow = level.firstRow;
+            continue;
+        }
+        Downsample(above.pixels, above.width, above.height, storage + (level.offset - levels[1].offset),
+                   level.width, level.firstRow, level.endRow);
+    }
+}
+
+int MipPyramid::getLevelCount() {
+    return levelCount;
+}
+
+const MipLevel &MipPyramid::getLevel(int level) {
+    return levels[level];
+}
+
+/**
+ * @return Samples in all the levels together, level 0 included
+ */
+size_t MipPyramid::getSamples() {
+    return samples;
+}
+
+/**
+ * Rows firstRow to endRow - 1 of destination, each sample the rounded mean of the 2x2 block of source above it. An
+ * odd last row or column of source is left out, like GL's own rounding down of mip sizes; a source only one sample
+ * wide or high is filtered along the other direction alone.
+ */
+void MipPyramid::Downsample(const uint16_t *source, int sourceWidth, int sourceHeight, uint16_t *destination,
+                            int width, int firstRow, int endRow) {
+    size_t down = sourceHeight > 1 ? sourceWidth : 0;
+    int right = sourceWidth > 1 ? 1 : 0;
+
+    for (int y=firstRow; y<endRow; y++) {
+        const uint16_t *top = source + (size_t)(y * 2) * down;
+        const uint16_t *bottom = top + down;
+        uint16_t *out = destination + (size_t)y * width;
+        for (int x=0; x<width; x++) {
+            out[x] = (uint16_t)((top[2 * x] + top[2 * x + right] + bottom[2 * x] + bottom[2 * x + right] + 2) >> 2);
+        }
+    }
+}
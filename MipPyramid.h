@@ -0,0 +1,42 @@
+#ifndef S2500_IMAGE_VIEWER_MIPPYRAMID_H
+#define S2500_IMAGE_VIEWER_MIPPYRAMID_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define MIP_PYRAMID_MAX_LEVELS  16
+#define MIP_PYRAMID_SMALLEST    32  // no more levels once the larger side is this small
+
+struct MipLevel {
+    int width;
+    int height;
+    const uint16_t *pixels;         // level 0's belong to the caller of update()
+    size_t offset;                  // of the level's first sample, counting from level 0's
+    int firstRow;                   // rows the last update() changed: firstRow to endRow - 1
+    int endRow;
+};
+
+/**
+ * The mip levels of a frame, each a 2x2 box filter of the one above, kept on the CPU so that a band of new rows only
+ * has to be filtered down through the levels below it. glGenerateMipmap would redo the whole texture every frame
+ * for what's usually a band of a few dozen rows.
+ */
+class MipPyramid {
+    private:
+        MipLevel levels[MIP_PYRAMID_MAX_LEVELS] = {};
+        int levelCount = 0;
+        uint16_t *storage = nullptr;    // levels 1 and below
+        size_t samples = 0;
+
+    public:
+        ~MipPyramid();
+        void allocate(int width, int height);
+        void update(const uint16_t *pixels, int firstRow, int numRows);
+        int getLevelCount();
+        const MipLevel &getLevel(int level);
+        size_t getSamples();
+        static void Downsample(const uint16_t *source, int sourceWidth, int sourceHeight, uint16_t *destination,
+                               int width, int firstRow, int endRow);
+};
+
+#endif //S2500_IMAGE_VIEWER_MIPPYRAMID_H
@@ -0,0 +1,91 @@
+#include "PerfMonitor.h"
+#include <cstring>
+
+PerfMonitor *PerfMonitor::m_pInstance = nullptr;
+
+PerfMonitor *PerfMonitor::Instance() {
+    if (!m_pInstance) {
+        m_pInstance = new PerfMonitor;
+    }
+    return m_pInstance;
+}
+
+PerfMonitor::PerfMonitor() {
+    for (int i=0; i<PERF_COUNTERS; i++) {
+        counters[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i=0; i<PERF_QUEUES; i++) {
+        depths[i].store(0, std::memory_order_relaxed);
+    }
+    memset(lastCounts, 0, sizeof(lastCounts));
+    memset(lastCounters, 0, sizeof(lastCounters));
+    lastSample = Now();
+}
+
+/**
+ * Takes a sample for the history if PERF_INTERVAL_MS have passed since the last one. Call from one thread only.
+ * @return True if a sample was taken
+ */
+bool PerfMonitor::sample() {
+    int64_t now = Now();
+    double seconds = (now - lastSample) / 1e9;
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t value;
+    double busy;
+
+    if (seconds * 1000 < PERF_INTERVAL_MS) {
+        return false;
+    }
+    lastSample = now;
+
+    for (int stage=0; stage<PERF_STAGES; stage++) {
+        stages[stage].snapshot(counts);
+        busy = 0;
+        for (int i=0; i<LATENCY_BUCKETS; i++) {
+            value = counts[i];
+            // A reset() since the last sample leaves counts below lastCounts; start over from zero
+            counts[i] = value >= lastCounts[stage][i] ? value - lastCounts[stage][i] : value;
+            lastCounts[stage][i] = value;
+            busy += counts[i] * LatencyHistogram::ValueOf(i);
+        }
+        p50[stage][next] = (float)(LatencyHistogram::Percentile(counts, 0.5) / 1e6);
+        p99[stage][next] = (float)(LatencyHistogram::Percentile(counts, 0.99) / 1e6);
+        worst[stage][next] = (float)(LatencyHistogram::Percentile(counts, 1.0) / 1e6);
+        load[stage][next] = (float)(busy / (seconds * 1e9));
+    }
+    for (int counter=0; counter<PERF_COUNTERS; counter++) {
+        value = counters[counter].load(std::memory_order_relaxed);
+        rates[counter][next] = (float)((value - lastCounters[counter]) / seconds);
+        lastCounters[counter] = value;
+    }
+    for (int queue=0; queue<PERF_QUEUES; queue++) {
+        queueDepths[queue][next] = (float)depths[queue].load(std::memory_order_relaxed);
+    }
+    next = (next + 1) % PERF_HISTORY;
+    return true;
+}
+
+/**
+ * Copies out a stage's histogram over the whole run, LATENCY_BUCKETS counts
+ */
+void PerfMonitor::getTotals(PerfStage stage, uint64_t *counts) {
+    stages[stage].snapshot(counts);
+}
+
+uint64_t PerfMonitor::getCounter(PerfCounter counter) {
+    return counters[counter].load(std::memory_order_relaxed);
+}
+
+// The history arrays are rings; this is where the oldest sample is, the offset ImGui::PlotLines takes
+int PerfMonitor::getHistoryStart() {
+    return next;
+}
+
+/**
+ * Starts the run-long histograms over. Counters keep counting
+ */
+void PerfMonitor::reset() {
+    for (int stage=0; stage<PERF_STAGES; stage++) {
+        stages[stage].reset();
+    }
+}
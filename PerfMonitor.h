@@ -0,0 +1,104 @@
+#ifndef S2500_IMAGE_VIEWER_PERFMONITOR_H
+#define S2500_IMAGE_VIEWER_PERFMONITOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "latency_histogram.h"
+
+#define PERF_HISTORY        120     // samples kept for the sparklines
+#define PERF_INTERVAL_MS    250     // between samples
+
+// Where time goes between the capture source and the screen, in pipeline order
+enum PerfStage {
+    PERF_READ,              // a read from the capture source, per chunk
+    PERF_RING_WAIT,         // a chunk waiting in the sample ring for the decoder
+    PERF_DECODE,            // decoding a chunk, less the publishing done in it
+    PERF_PUBLISH,           // frame sync: publishing the frame and handing it to the writer and stacker
+    PERF_UPLOAD,            // texture upload, per UI frame
+    PERF_FRAME_AGE,         // frame sync to the frame's upload
+    PERF_PRESENT,           // buffer swap, per UI frame
+    PERF_WRITE,             // encoding and writing a saved frame
+    PERF_STAGES,
+};
+
+enum PerfCounter {
+    PERF_BYTES_READ,
+    PERF_SAMPLES_DECODED,
+    PERF_FRAMES_PUBLISHED,
+    PERF_FRAMES_UPLOADED,
+    PERF_UI_FRAMES,
+    PERF_COUNTERS,
+};
+
+enum PerfQueue {
+    PERF_QUEUE_SAMPLE_RING, // chunks
+    PERF_QUEUE_WRITER,      // frames
+    PERF_QUEUE_FRAME_BUFFERS,
+    PERF_QUEUES,
+};
+
+/**
+ * Pipeline instrumentation. The stages record durations into LatencyHistograms and bump counters, each with a
+ * relaxed atomic increment and no locks; queue depths are reported by whoever can see the queue. The UI calls
+ * sample() every frame, and every PERF_INTERVAL_MS it turns what was recorded since the last sample into per-stage
+ * percentiles, rates and depths for the performance panel, PERF_HISTORY samples deep.
+ *
+ * Stage histograms also accumulate over the whole run, until reset().
+ */
+class PerfMonitor {
+    private:
+        LatencyHistogram stages[PERF_STAGES];
+        std::atomic<uint64_t> counters[PERF_COUNTERS];
+        std::atomic<uint32_t> depths[PERF_QUEUES];
+
+        // Owned by the thread calling sample()
+        uint64_t lastCounts[PERF_STAGES][LATENCY_BUCKETS];
+        uint64_t lastCounters[PERF_COUNTERS];
+        int64_t lastSample = 0;
+        int next = 0;
+
+        PerfMonitor();
+        static PerfMonitor *m_pInstance;
+
+    public:
+        // Per-sample history for the sparklines, oldest first from getHistoryStart()
+        float p50[PERF_STAGES][PERF_HISTORY] = {};          // ms
+        float p99[PERF_STAGES][PERF_HISTORY] = {};
+        float worst[PERF_STAGES][PERF_HISTORY] = {};
+        float load[PERF_STAGES][PERF_HISTORY] = {};         // fraction of the interval spent in the stage
+        float rates[PERF_COUNTERS][PERF_HISTORY] = {};      // per second
+        float queueDepths[PERF_QUEUES][PERF_HISTORY] = {};
+
+        static PerfMonitor *Instance();
+
+        static int64_t Now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void record(PerfStage stage, int64_t nanoseconds) {
+            stages[stage].record(nanoseconds > 0 ? nanoseconds : 0);
+        }
+
+        // Records the time since start, which came from Now()
+        void recordSince(PerfStage stage, int64_t start) {
+            record(stage, Now() - start);
+        }
+
+        void count(PerfCounter counter, uint64_t amount = 1) {
+            counters[counter].fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        void setDepth(PerfQueue queue, uint32_t depth) {
+            depths[queue].store(depth, std::memory_order_relaxed);
+        }
+
+        bool sample();
+        void getTotals(PerfStage stage, uint64_t *counts);
+        uint64_t getCounter(PerfCounter counter);
+        int getHistoryStart();
+        void reset();
+};
+
+#endif //S2500_IMAGE_VIEWER_PERFMONITOR_H
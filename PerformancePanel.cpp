@@ -0,0 +1,134 @@
+#include "PerformancePanel.h"
+#include <cfloat>
+#include <cstdio>
+#include "imgui/imgui.h"
+
+static const char *stageNames[PERF_STAGES] = {
+    "Read", "Ring wait", "Decode", "Publish", "Upload", "Frame age", "Present", "Write"
+};
+// Stages that are work done on a thread, rather than time spent waiting (a read blocks on the source, a swap on
+// vsync); only these can be the bottleneck. Decode and publish share the decode thread and are counted together;
+// the decoder leaves the time it spends publishing out of its decode time, so neither is counted twice
+static const bool stageIsWork[PERF_STAGES] = { false, false, true, true, true, false, false, true };
+static const char *counterNames[PERF_COUNTERS] = {
+    "MB/s read", "MS/s decoded", "Frames/s published", "Frames/s shown", "UI frames/s"
+};
+static const double counterScales[PERF_COUNTERS] = { 1e-6, 1e-6, 1, 1, 1 };
+static const char *queueNames[PERF_QUEUES] = { "Sample ring (chunks)", "Writer queue (frames)", "Frame buffers" };
+
+PerformancePanel::PerformancePanel(PerfMonitor &monitor) : monitor(monitor) {
+}
+
+static int Latest(int start) {
+    return (start + PERF_HISTORY - 1) % PERF_HISTORY;
+}
+
+void PerformancePanel::drawStages() {
+    uint64_t counts[LATENCY_BUCKETS];
+    int start = monitor.getHistoryStart();
+    int latest = Latest(start);
+    float busiest = 0;
+    int bottleneck = -1;
+    float stageLoad;
+
+    for (int stage=0; stage<PERF_STAGES; stage++) {
+        stageLoad = monitor.load[stage][latest] + (stage == PERF_DECODE ? monitor.load[PERF_PUBLISH][latest] : 0);
+        if (stageIsWork[stage] && stage != PERF_PUBLISH && stageLoad > busiest) {
+            busiest = stageLoad;
+            bottleneck = stage;
+        }
+    }
+
+    if (!ImGui::BeginTable("Stages", 7, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        return;
+    }
+    ImGui::TableSetupColumn("Stage");
+    ImGui::TableSetupColumn("p50 ms");
+    ImGui::TableSetupColumn("p99 ms");
+    ImGui::TableSetupColumn("p99.9 ms");
+    ImGui::TableSetupColumn("Max ms");
+    ImGui::TableSetupColumn("Busy");
+    ImGui::TableSetupColumn("p99, recent", ImGuiTableColumnFlags_WidthStretch);
+    ImGui::TableHeadersRow();
+    for (int stage=0; stage<PERF_STAGES; stage++) {
+        monitor.getTotals((PerfStage)stage, counts);
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        if (stage == bottleneck) {
+            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", stageNames[stage]);
+        } else {
+            ImGui::TextUnformatted(stageNames[stage]);
+        }
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", LatencyHistogram::Percentile(counts, 0.5) / 1e6);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", LatencyHistogram::Percentile(counts, 0.99) / 1e6);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", LatencyHistogram::Percentile(counts, 0.999) / 1e6);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", LatencyHistogram::Percentile(counts, 1.0) / 1e6);
+        ImGui::TableNextColumn();
+        if (stageIsWork[stage]) {
+            ImGui::Text("%.0f%%", monitor.load[stage][latest] * 100);
+        }
+        ImGui::TableNextColumn();
+        ImGui::PushID(stage);
+        ImGui::PlotLines("##p99", monitor.p99[stage], PERF_HISTORY, start, nullptr, 0.0f, FLT_MAX,
+                         ImVec2(-1.0f, 24.0f));
+        ImGui::PopID();
+    }
+    ImGui::EndTable();
+}
+
+void PerformancePanel::drawRates() {
+    int start = monitor.getHistoryStart();
+    int latest = Latest(start);
+    char label[64];
+
+    for (int counter=0; counter<PERF_COUNTERS; counter++) {
+        snprintf(label, sizeof(label), "%.1f %s", monitor.rates[counter][latest] * counterScales[counter],
+                 counterNames[counter]);
+        ImGui::PushID(counter);
+        ImGui::PlotLines("##rate", monitor.rates[counter], PERF_HISTORY, start, label, 0.0f, FLT_MAX,
+                         ImVec2(-1.0f, 32.0f));
+        ImGui::PopID();
+    }
+}
+
+void PerformancePanel::drawQueues() {
+    int start = monitor.getHistoryStart();
+    int latest = Latest(start);
+    char label[64];
+
+    for (int queue=0; queue<PERF_QUEUES; queue++) {
+        snprintf(label, sizeof(label), "%.0f %s", monitor.queueDepths[queue][latest], queueNames[queue]);
+        ImGui::PushID(queue);
+        ImGui::PlotLines("##depth", monitor.queueDepths[queue], PERF_HISTORY, start, label, 0.0f, FLT_MAX,
+                         ImVec2(-1.0f, 32.0f));
+        ImGui::PopID();
+    }
+}
+
+void PerformancePanel::draw(bool *open) {
+    ImGui::SetNextWindowSize(ImVec2(640, 620), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Performance", open)) {
+        ImGui::End();
+        return;
+    }
+    ImGui::TextColored(ImVec4(1.0f, 0.0f, 1.0f, 1.0f), "Latency");
+    drawStages();
+    if (ImGui::Button("Reset histograms")) {
+        monitor.reset();
+    }
+    ImGui::Dummy(ImVec2(0.0f, 4.0f));
+    ImGui::TextColored(ImVec4(1.0f, 0.0f, 1.0f, 1.0f), "Throughput");
+    ImGui::PushID("rates");
+    drawRates();
+    ImGui::PopID();
+    ImGui::Dummy(ImVec2(0.0f, 4.0f));
+    ImGui::TextColored(ImVec4(1.0f, 0.0f, 1.0f, 1.0f), "Queues");
+    ImGui::PushID("queues");
+    drawQueues();
+    ImGui::PopID();
+    ImGui::End();
+}
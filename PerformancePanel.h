@@ -0,0 +1,25 @@
+#ifndef S2500_IMAGE_VIEWER_PERFORMANCEPANEL_H
+#define S2500_IMAGE_VIEWER_PERFORMANCEPANEL_H
+
+#include "PerfMonitor.h"
+
+/**
+ * The performance window: for each pipeline stage its latency percentiles over the whole run and a sparkline of the
+ * 99th percentile per PERF_INTERVAL_MS, then throughput and queue depths the same way. Of the stages that do work on
+ * a thread of their own, the one that was busy for the largest share of the last interval is highlighted as the
+ * likely bottleneck.
+ */
+class PerformancePanel {
+    private:
+        PerfMonitor &monitor;
+
+        void drawStages();
+        void drawRates();
+        void drawQueues();
+
+    public:
+        explicit PerformancePanel(PerfMonitor &monitor);
+        void draw(bool *open);
+};
+
+#endif //S2500_IMAGE_VIEWER_PERFORMANCEPANEL_H
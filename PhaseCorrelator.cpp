@@ -0,0 +1,138 @@
+#include "PhaseCorrelator.h"
+#include <cmath>
+
+/**
+ * @param size Width and height of the images, a power of two
+ */
+PhaseCorrelator::PhaseCorrelator(uint32_t size) {
+    this->size = size;
+    log2Size = 0;
+    while ((1u << log2Size) < size) {
+        log2Size++;
+    }
+
+    twiddles.resize(size / 2);
+    for (uint32_t i=0; i<size/2; i++) {
+        double angle = -2.0 * M_PI * i / size;
+        twiddles[i] = std::complex<float>((float)cos(angle), (float)sin(angle));
+    }
+    bitReversed.resize(size);
+    for (uint32_t i=0; i<size; i++) {
+        uint32_t r = 0;
+        for (uint32_t b=0; b<log2Size; b++) {
+            r |= ((i >> b) & 1) << (log2Size - 1 - b);
+        }
+        bitReversed[i] = r;
+    }
+    reference.resize((size_t)size * size);
+    spectrum.resize((size_t)size * size);
+    column.resize(size);
+}
+
+uint32_t PhaseCorrelator::getSize() {
+    return size;
+}
+
+/**
+ * In-place transform of size contiguous values. The inverse isn't scaled.
+ */
+void PhaseCorrelator::fft(std::complex<float> *data, bool inverse) {
+    for (uint32_t i=0; i<size; i++) {
+        if (i < bitReversed[i]) {
+            std::swap(data[i], data[bitReversed[i]]);
+        }
+    }
+    for (uint32_t half=1, step=size/2; half<size; half*=2, step/=2) {
+        for (uint32_t start=0; start<size; start+=half*2) {
+            for (uint32_t k=0; k<half; k++) {
+                std::complex<float> w = inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+                std::complex<float> t = w * data[start + k + half];
+                data[start + k + half] = data[start + k] - t;
+                data[start + k] += t;
+            }
+        }
+    }
+}
+
+void PhaseCorrelator::fft2d(std::vector<std::complex<float>> &data, bool inverse) {
+    for (uint32_t y=0; y<size; y++) {
+        fft(data.data() + (size_t)y * size, inverse);
+    }
+    // Columns go through a contiguous copy so the butterflies don't stride across the whole image
+    for (uint32_t x=0; x<size; x++) {
+        for (uint32_t y=0; y<size; y++) {
+            column[y] = data[(size_t)y * size + x];
+        }
+        fft(column.data(), inverse);
+        for (uint32_t y=0; y<size; y++) {
+            data[(size_t)y * size + x] = column[y];
+        }
+    }
+}
+
+void PhaseCorrelator::load(const float *image, std::vector<std::complex<float>> &data) {
+    for (size_t i=0; i<(size_t)size * size; i++) {
+        data[i] = std::complex<float>(image[i], 0.0f);
+    }
+    fft2d(data, false);
+}
+
+/**
+ * @param image size * size samples, ideally mean-subtracted and windowed
+ */
+void PhaseCorrelator::setReference(const float *image) {
+    load(image, reference);
+    hasReference = true;
+}
+
+/**
+ * Finds how far the content of image has moved relative to the reference
+ * @param image size * size samples, prepared the same way as the reference
+ * @param dx Shift in x, in pixels, positive when the content moved right
+ * @param dy Shift in y, positive when the content moved down
+ * @param peak Height of the correlation peak, 0 to 1. Low values mean the match is unreliable
+ * @return False if there's no reference yet
+ */
+bool PhaseCorrelator::correlate(const float *image, float *dx, float *dy, float *peak) {
+    size_t count = (size_t)size * size;
+    size_t best = 0;
+    float bestValue = -1e30f;
+
+    if (!hasReference) {
+        return false;
+    }
+    load(image, spectrum);
+    for (size_t i=0; i<count; i++) {
+        std::complex<float> cross = reference[i] * std::conj(spectrum[i]);
+        float magnitude = std::abs(cross);
+        spectrum[i] = magnitude > 1e-12f ? cross / magnitude : std::complex<float>(0.0f, 0.0f);
+    }
+    fft2d(spectrum, true);
+    for (size_t i=0; i<count; i++) {
+        if (spectrum[i].real() > bestValue) {
+            bestValue = spectrum[i].real();
+            best = i;
+        }
+    }
+
+    uint32_t px = best % size;
+    uint32_t py = best / size;
+    auto at = [this](uint32_t x, uint32_t y) {
+        return spectrum[(size_t)(y & (size - 1)) * size + (x & (size - 1))].real();
+    };
+    // Parabola through the peak and its neighbours on each axis
+    float left = at(px - 1, py), right = at(px + 1, py);
+    float up = at(px, py - 1), down = at(px, py + 1);
+    float denominatorX = left - 2.0f * bestValue + right;
+    float denominatorY = up - 2.0f * bestValue + down;
+    float subX = denominatorX < 0.0f ? 0.5f * (left - right) / denominatorX : 0.0f;
+    float subY = denominatorY < 0.0f ? 0.5f * (up - down) / denominatorY : 0.0f;
+
+    // The peak sits at the reference-to-image offset, wrapped around; the image moved the other way
+    float shiftX = (px > size / 2 ? (float)px - size : (float)px) + subX;
+    float shiftY = (py > size / 2 ? (float)py - size : (float)py) + subY;
+    *dx = -shiftX;
+    *dy = -shiftY;
+    *peak = bestValue / count;
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef S2500_IMAGE_VIEWER_PHASECORRELATOR_H
+#define S2500_IMAGE_VIEWER_PHASECORRELATOR_H
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Finds the translation between two size x size images (size a power of two) by phase correlation: the normalized
+ * cross-power spectrum of the two is transformed back, and the position of its peak, refined to sub-pixel with a
+ * parabola through its neighbours, is the shift. The FFT is a plain iterative radix-2 one.
+ */
+class PhaseCorrelator {
+    private:
+        uint32_t size;
+        uint32_t log2Size;
+        std::vector<std::complex<float>> twiddles;
+        std::vector<uint32_t> bitReversed;
+        std::vector<std::complex<float>> reference;    // spectrum of the reference image
+        std::vector<std::complex<float>> spectrum;
+        std::vector<std::complex<float>> column;
+        bool hasReference = false;
+
+        void fft(std::complex<float> *data, bool inverse);
+        void fft2d(std::vector<std::complex<float>> &data, bool inverse);
+        void load(const float *image, std::vector<std::complex<float>> &data);
+
+    public:
+        PhaseCorrelator(uint32_t size);
+        uint32_t getSize();
+        void setReference(const float *image);
+        bool correlate(const float *image, float *dx, float *dy, float *peak);
+};
+
+#endif //S2500_IMAGE_VIEWER_PHASECORRELATOR_H
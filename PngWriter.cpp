@@ -0,0 +1,211 @@
+#include "PngWriter.h"
+#include "TiffWriter.h"
+#include "ThreadPool.h"
+#include "Logger.h"
+#include <cstring>
+#include <zlib.h>
+
+#define PNG_COLOUR_GRAY     0
+#define PNG_FILTER_SUB      1
+#define PNG_WINDOW_BYTES    32768   // deflate looks back this far, so that's all of a strip the next one needs
+
+static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+static const uint8_t iend[] = { 0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82 };
+
+static void PutBigEndian(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+/**
+ * Appends a whole chunk: length, type, data and CRC
+ */
+static void AppendChunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, uint32_t length) {
+    size_t start = out.size();
+    uint32_t crc;
+
+    out.resize(start + 8 + length + 4);
+    PutBigEndian(out.data() + start, length);
+    memcpy(out.data() + start + 4, type, 4);
+    if (length) {
+        memcpy(out.data() + start + 8, data, length);
+    }
+    crc = crc32(0, out.data() + start + 4, 4 + length);
+    PutBigEndian(out.data() + start + 8 + length, crc);
+}
+
+/**
+ * Compresses the frame and lays out the PNG. The buffers iov points at belong to the PngWriter and stay valid until
+ * the next call.
+ * @param snapshot
+ * @param level zlib level, 1 (fastest) to 9 (smallest)
+ * @param pool Filters and compresses the strips
+ * @param iov Filled with the pieces of the file, in order
+ * @return True on success
+ */
+bool PngWriter::encode(const SEMFrameSnapshot &snapshot, int level, ThreadPool &pool, std::vector<struct iovec> &iov) {
+    uint32_t numStrips = (snapshot.height + PNG_WRITER_ROWS_PER_STRIP - 1) / PNG_WRITER_ROWS_PER_STRIP;
+    std::vector<uint8_t> ok(numStrips, 0);
+    uint64_t idatBytes = 2 + 4;     // zlib header and Adler-32
+    uint32_t adler;
+    uint32_t crc;
+    bool allOk = true;
+
+    if (strips.size() < numStrips) {
+        strips.resize(numStrips);
+        stripBytes.resize(numStrips);
+        filtered.resize(numStrips);
+        stripAdler.resize(numStrips);
+        stripCrc.resize(numStrips);
+    }
+
+    // Every strip is filtered before any is compressed: each one starts from the tail of the one before
+    pool.parallelFor(numStrips, [&](uint32_t strip) {
+        filterStrip(snapshot, strip);
+    });
+    pool.parallelFor(numStrips, [&](uint32_t strip) {
+        ok[strip] = compressStrip(strip, numStrips, level);
+    });
+    for (uint32_t strip=0; strip<numStrips; strip++) {
+        allOk = allOk && ok[strip];
+        idatBytes += stripBytes[strip];
+    }
+    if (!allOk) {
+        Logger::Instance()->log("Unable to compress frame %d", snapshot.fileNumber);
+        return false;
+    }
+    if (idatBytes > INT32_MAX) {
+        Logger::Instance()->log("Frame %d is too big for a PNG", snapshot.fileNumber);
+        return false;
+    }
+
+    buildHeader(snapshot, level);
+    PutBigEndian(header.data() + header.size() - 10, (uint32_t)idatBytes);
+
+    // The strips' checksums are put together rather than run over the whole frame again
+    crc = crc32(0, header.data() + header.size() - 6, 6);
+    adler = adler32(0, nullptr, 0);
+    for (uint32_t strip=0; strip<numStrips; strip++) {
+        crc = crc32_combine(crc, stripCrc[strip], stripBytes[strip]);
+        adler = adler32_combine(adler, stripAdler[strip], filtered[strip].size());
+    }
+    PutBigEndian(trailer, adler);
+    crc = crc32(crc, trailer, 4);
+    PutBigEndian(trailer + 4, crc);
+    memcpy(trailer + 8, iend, sizeof(iend));
+
+    iov.clear();
+    iov.push_back({ header.data(), header.size() });
+    for (uint32_t strip=0; strip<numStrips; strip++) {
+        iov.push_back({ strips[strip].data(), stripBytes[strip] });
+    }
+    iov.push_back({ trailer, sizeof(trailer) });
+    return true;
+}
+
+/**
+ * Turns a strip of the frame into PNG rows: a filter type byte, then each sample big-endian less the one to its left
+ */
+void PngWriter::filterStrip(const SEMFrameSnapshot &snapshot, uint32_t strip) {
+    uint32_t firstRow = strip * PNG_WRITER_ROWS_PER_STRIP;
+    uint32_t rows = snapshot.height - firstRow;
+    if (rows > PNG_WRITER_ROWS_PER_STRIP) {
+        rows = PNG_WRITER_ROWS_PER_STRIP;
+    }
+    size_t rowBytes = 1 + (size_t)snapshot.width * sizeof(uint16_t);
+    std::vector<uint8_t> &out = filtered[strip];
+
+    out.resize(rows * rowBytes);
+    for (uint32_t y=0; y<rows; y++) {
+        const uint16_t *in = snapshot.pixels + (size_t)(firstRow + y) * snapshot.width;
+        uint8_t *row = out.data() + y * rowBytes;
+        uint16_t left = 0;
+        row[0] = PNG_FILTER_SUB;
+        for (uint32_t x=0; x<snapshot.width; x++) {
+            // Sub works bytewise, high byte from high byte and low from low, with no borrow between them
+            row[1 + x * 2] = (uint8_t)((in[x] >> 8) - (left >> 8));
+            row[2 + x * 2] = (uint8_t)(in[x] - left);
+            left = in[x];
+        }
+    }
+}
+
+/**
+ * Deflates a filtered strip as a raw piece of the frame's zlib stream
+ * @param strip
+ * @param numStrips
+ * @param level
+ * @return True on success
+ */
+bool PngWriter::compressStrip(uint32_t strip, uint32_t numStrips, int level) {
+    const std::vector<uint8_t> &in = filtered[strip];
+    bool last = strip == numStrips - 1;
+    z_stream stream;
+    size_t bound;
+    int result;
+
+    memset(&stream, 0, sizeof(stream));
+    stripBytes[strip] = 0;
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    if (strip > 0) {
+        const std::vector<uint8_t> &previous = filtered[strip - 1];
+        size_t window = previous.size() < PNG_WINDOW_BYTES ? previous.size() : PNG_WINDOW_BYTES;
+        deflateSetDictionary(&stream, previous.data() + previous.size() - window, window);
+    }
+    // Room for the sync flush's empty stored block on top of the bound
+    bound = deflateBound(&stream, in.size()) + 16;
+    if (strips[strip].size() < bound) {
+        strips[strip].resize(bound);
+    }
+    stream.next_in = const_cast<Bytef *>(in.data());
+    stream.avail_in = in.size();
+    stream.next_out = strips[strip].data();
+    stream.avail_out = strips[strip].size();
+    result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    stripBytes[strip] = stream.total_out;
+    deflateEnd(&stream);
+    if (last ? result != Z_STREAM_END : (result != Z_OK || stream.avail_in != 0)) {
+        stripBytes[strip] = 0;
+        return false;
+    }
+    stripAdler[strip] = adler32(adler32(0, nullptr, 0), in.data(), in.size());
+    stripCrc[strip] = crc32(0, strips[strip].data(), stripBytes[strip]);
+    return true;
+}
+
+/**
+ * Lays out everything ahead of the compressed strips, ending with the IDAT length (filled in by the caller), its type
+ * and the zlib header
+ */
+void PngWriter::buildHeader(const SEMFrameSnapshot &snapshot, int level) {
+    static const char keyword[] = "Description";
+    char description[512];
+    uint8_t ihdr[13];
+    uint8_t zlibHeader[2];
+
+    header.assign(signature, signature + sizeof(signature));
+
+    PutBigEndian(ihdr, snapshot.width);
+    PutBigEndian(ihdr + 4, snapshot.height);
+    ihdr[8] = 16;                   // bit depth
+    ihdr[9] = PNG_COLOUR_GRAY;
+    ihdr[10] = 0;                   // deflate
+    ihdr[11] = 0;                   // adaptive filtering
+    ihdr[12] = 0;                   // not interlaced
+    AppendChunk(header, "IHDR", ihdr, sizeof(ihdr));
+
+    FormatFrameDescription(snapshot, description, sizeof(description));
+    std::vector<uint8_t> text(keyword, keyword + sizeof(keyword));
+    text.insert(text.end(), description, description + strlen(description));
+    AppendChunk(header, "tEXt", text.data(), text.size());
+
+    // Deflate with a 32K window, and the level as zlib would record it
+    zlibHeader[0] = 0x78;
+    zlibHeader[1] = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+    zlibHeader[1] += 31 - ((zlibHeader[0] << 8) + zlibHeader[1]) % 31;
+    header.insert(header.end(), { 0, 0, 0, 0, 'I', 'D', 'A', 'T', zlibHeader[0], zlibHeader[1] });
+}
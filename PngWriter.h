@@ -0,0 +1,39 @@
+#ifndef S2500_IMAGE_VIEWER_PNGWRITER_H
+#define S2500_IMAGE_VIEWER_PNGWRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/uio.h>
+#include "sem_frame_snapshot.h"
+
+#define PNG_WRITER_ROWS_PER_STRIP 64
+
+class ThreadPool;
+
+/**
+ * Encodes frames as 16-bit grayscale PNGs. Every row gets the Sub filter, and the frame is cut into strips of
+ * PNG_WRITER_ROWS_PER_STRIP rows that are deflated in parallel on a thread pool as pieces of one zlib stream: each
+ * strip but the last ends on a sync flush and is primed with the tail of the one before, so they simply join up into
+ * a single IDAT chunk. The file comes back as a list of buffers ready for a single writev(). The capture state goes in
+ * a tEXt chunk.
+ */
+class PngWriter {
+    private:
+        std::vector<uint8_t> header;                     // signature, IHDR, tEXt and the start of IDAT
+        uint8_t trailer[20];                             // Adler-32 of the stream, the IDAT CRC, and IEND
+        std::vector<std::vector<uint8_t>> filtered;      // filtered rows, per strip
+        std::vector<std::vector<uint8_t>> strips;        // deflated strips, reused from frame to frame
+        std::vector<size_t> stripBytes;
+        std::vector<uint32_t> stripAdler;                // of the filtered rows
+        std::vector<uint32_t> stripCrc;                  // of the deflated strip
+
+        void filterStrip(const SEMFrameSnapshot &snapshot, uint32_t strip);
+        bool compressStrip(uint32_t strip, uint32_t numStrips, int level);
+        void buildHeader(const SEMFrameSnapshot &snapshot, int level);
+
+    public:
+        bool encode(const SEMFrameSnapshot &snapshot, int level, ThreadPool &pool, std::vector<struct iovec> &iov);
+};
+
+#endif //S2500_IMAGE_VIEWER_PNGWRITER_H
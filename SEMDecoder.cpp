@@ -0,0 +1,319 @@
+#include "SEMDecoder.h"
+#include "SampleRing.h"
+#include "SequenceWriter.h"
+#include "FrameStacker.h"
+#include "Logger.h"
+#include "PerfMonitor.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+SEMDecoder::SEMDecoder(SEMCapture *ci, SEMCapturePixels *p, SequenceWriter *writer) {
+    this->ci = ci;
+    this->p = p;
+    this->writer = writer;
+    this->kernels = &GetDecodeKernels();
+    Logger::Instance()->log("Using %s decode kernels", kernels->name);
+}
+
+SEMDecoder::~SEMDecoder() {
+    stop();
+}
+
+void SEMDecoder::start() {
+    if (shouldDecode) {
+        return;
+    }
+    resetStream();
+    shouldDecode = true;
+    decodeThread = std::thread(&SEMDecoder::decodeLoop, this);
+}
+
+/**
+ * Stops the decode thread and waits for it to finish the chunk it's on. Must be called before the capture's ring is
+ * deleted or replaced.
+ */
+void SEMDecoder::stop() {
+    if (!shouldDecode) {
+        return;
+    }
+    shouldDecode = false;
+    decodeThread.join();
+}
+
+void SEMDecoder::setKernels(const DecodeKernels *kernels) {
+    this->kernels = kernels;
+    Logger::Instance()->log("Using %s decode kernels", kernels->name);
+}
+
+void SEMDecoder::setStacker(FrameStacker *stacker) {
+    this->stacker = stacker;
+}
+
+void SEMDecoder::decodeLoop() {
+    SampleChunk *chunk;
+
+    while (shouldDecode) {
+        chunk = ci->ring->peekRead();
+        if (chunk == nullptr) {
+            // Nothing queued. The tty delivers far less than a chunk per 500 µs so this costs us no throughput
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+            continue;
+        }
+        if (chunk->committedNanoseconds) {
+            PerfMonitor::Instance()->recordSince(PERF_RING_WAIT, chunk->committedNanoseconds);
+        }
+        ci->bytesRead += chunk->bytes;
+        parse(chunk->data, chunk->bytes);
+        ci->ring->releaseRead();
+    }
+}
+
+/**
+ * Decodes one chunk of the byte stream. Chunks can be any size: a sync packet or even a single sample split across
+ * two chunks is carried over and finished by the next call.
+ * @param buf
+ * @param bytesRead
+ */
+void SEMDecoder::parse(const uint16_t *buf, ssize_t bytesRead) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(buf);
+    uint16_t sample;
+
+    if (bytesRead <= 0) {
+        return;
+    }
+    if (resetMinMax.exchange(false)) {
+        p->min = MAX_ADC_VAL;
+        p->max = 0;
+        p->histogram.reset();
+    }
+
+    int64_t decodeStart = PerfMonitor::Now();
+    publishNanoseconds = 0;
+    if (hasOddByte) {
+        // The last chunk ended halfway through a sample (little-endian on the wire). Finish it, after which the rest
+        // of this chunk is a byte out of alignment and has to be copied before it can be read as samples
+        sample = oddByte | (bytes[0] << 8);
+        hasOddByte = false;
+        parseSamples(&sample, 1);
+        bytes++;
+        bytesRead--;
+        if (bytesRead >= (ssize_t)sizeof(uint16_t)) {
+            realigned.resize(bytesRead / sizeof(uint16_t));
+            memcpy(realigned.data(), bytes, realigned.size() * sizeof(uint16_t));
+            parseSamples(realigned.data(), realigned.size());
+        }
+    } else {
+        parseSamples(buf, bytesRead / sizeof(uint16_t));
+    }
+    if (bytesRead & 1) {
+        oddByte = bytes[bytesRead - 1];
+        hasOddByte = true;
+    }
+    PerfMonitor::Instance()->record(PERF_DECODE, PerfMonitor::Now() - decodeStart - publishNanoseconds);
+    PerfMonitor::Instance()->count(PERF_SAMPLES_DECODED, bytesRead / sizeof(uint16_t));
+}
+
+/**
+ * Forgets any partial packet or sample carried over from the last chunk. Call when the stream restarts.
+ */
+void SEMDecoder::resetStream() {
+    packetFill = 0;
+    hasOddByte = false;
+    geometry.reset();
+    if (savingFrame) {
+        // The requested frame was cut short; take the next whole one instead
+        savingFrame = false;
+        saveNextFrame = true;
+    }
+}
+
+void SEMDecoder::parseSamples(const uint16_t *buf, uint32_t numSamples) {
+    uint32_t i = 0;
+    uint32_t n;
+
+    while (i < numSamples) {
+        if (packetFill > 0 || buf[i] == 0xFEFA || buf[i] == 0xFEFB || buf[i] == 0xFEFC) {
+            if (packetFill == 0 && numSamples - i >= SYNC_PACKET_SAMPLES) {
+                // Whole packet is in this chunk
+                parseStatusBytes(buf + i);
+                i += SYNC_PACKET_SAMPLES;
+                continue;
+            }
+            // Packet straddles the chunk boundary (or we're finishing one that did); collect it
+            n = SYNC_PACKET_SAMPLES - packetFill;
+            if (n > numSamples - i) {
+                n = numSamples - i;
+            }
+            memcpy(packet + packetFill, buf + i, n * sizeof(uint16_t));
+            packetFill += n;
+            i += n;
+            if (packetFill == SYNC_PACKET_SAMPLES) {
+                parseStatusBytes(packet);
+                packetFill = 0;
+            }
+            continue;
+        }
+        n = kernels->findSyncMarker(buf + i, numSamples - i);
+        decodeRun(buf + i, n);
+        i += n;
+    }
+}
+
+/**
+ * Decodes a run of pixel samples that contains no sync markers, splitting it at row ends.
+ * @param run
+ * @param count Number of samples in the run
+ */
+void SEMDecoder::decodeRun(const uint16_t *run, uint32_t count) {
+    uint16_t min = p->min;
+    uint16_t max = p->max;
+    uint32_t n;
+
+    kernels->minMax(run, count, MAX_ADC_VAL, &min, &max);
+    p->histogram.add(*kernels, run, count);
+    geometry.addSamples(count);
+    if (min != p->min || max != p->max) {
+        p->min = min;
+        p->max = max;
+        Logger::Instance()->log("min/max: %d/%d", p->min, p->max);
+    }
+    if (p->max == 0) {
+        p->max = 1;
+    }
+
+    while (count > 0) {
+        if (p->y >= ci->sourceHeight) {
+            p->y = 0;
+            overflowRows++;
+        }
+        if (p->x < ci->sourceWidth) {
+            n = ci->sourceWidth - p->x;
+            if (n > count) {
+                n = count;
+            }
+            memcpy(&p->pixels[(p->y * ci->sourceWidth) + p->x], run, n * sizeof(uint16_t));
+            p->frames.markRowDirty(p->y);
+            p->x += n;
+            run += n;
+            count -= n;
+        } else {
+            // The sample that overflowed is dropped and the row wraps
+            overflowSamples++;
+            p->x = 1;
+            p->y += 1;
+            run++;
+            count--;
+        }
+    }
+}
+
+/**
+ * Hands the frame that was just published to the writer to be saved, if it's the one "Save next frame" asked for
+ */
+void SEMDecoder::saveRequestedFrame() {
+    const SEMFrameSnapshot *frame;
+
+    if (!savingFrame) {
+        return;
+    }
+    if (!(frame = p->frames.pinJustPublished())) {
+        // Held back rather than published, so it's still being scanned over; save the next one instead
+        return;
+    }
+    savingFrame = false;
+    writer->queueRequestedSnapshot(p->frames, frame);
+    Logger::Instance()->log("Frame %u captured for saving", frame->frameNumber);
+}
+
+/**
+ * Status bytes are sent every X and/or Y pulse
+ * @param packet A complete SYNC_PACKET_SAMPLES packet, starting with its marker
+ */
+void SEMDecoder::parseStatusBytes(const uint16_t *packet) {
+    bool newFrame = packet[0] == 0xFEFB;
+    uint8_t scannedMode = ci->scanMode;     // of the row (and frame) that this pulse ends
+
+    if (packet[0] == 0xFEFC) {
+        Logger::Instance()->log("Heartbeat!");
+        ci->heartbeat = true;
+        return;
+    }
+    ci->syncDuration    = packet[1];
+    ci->syncDuration   += ((double)packet[2]) / 1e6;
+    ci->scanMode        = packet[3];
+    ci->frameDuration   = packet[4] / 16;
+    ci->frameDuration  += ((double)packet[5]) / 1e6;
+
+    if (ci->syncDuration > ci->maxSync) {
+        ci->maxSync = ci->syncDuration;
+    }
+    if (ci->syncDuration < ci->minSync) {
+        ci->minSync = ci->syncDuration;
+    }
+
+    if (newFrame) {
+        endFrame(scannedMode);
+    } else {
+        // Just an X pulse
+//        Logger::Instance()->log("x pulse\n\tx: %d\n\tscanMode: %d\n\tpulse duration: %f\n\tframe duration: %f", p->x, ci->scanMode, ci->syncDuration, ci->frameDuration);
+//        Logger::Instance()->log("\tsyncAverage: %f\n\tmaxSync: %f\n\tminSync: %f", ci->syncAverage/ci->syncNum, ci->maxSync, ci->minSync);
+        p->x = 0;
+        p->y += 1;
+        p->histogram.endRow();
+        geometry.endRow();
+    }
+    ci->syncNum += 1;
+    ci->syncAverage += ci->syncDuration;
+}
+
+/**
+ * This pulse is an X+Y pulse. Publishes the frame that just finished and carries on in a buffer nobody is reading,
+ * at the size the next frame is expected to be. The writer and the stacker pin the published frame and read it on
+ * their own threads
+ * @param scannedMode The scan mode the finished frame was scanned in
+ */
+void SEMDecoder::endFrame(uint8_t scannedMode) {
+    FrameGeometry current;
+    FrameGeometry next;
+
+    current.width = ci->sourceWidth;
+    current.height = ci->sourceHeight;
+    next = geometry.endFrame(scannedMode, ci->scanMode, current);
+    if (overflowSamples || overflowRows) {
+        Logger::Instance()->log("[WARN] %u samples ran past the end of a row and %u rows past the end of the %dx%d "
+                                "frame", overflowSamples, overflowRows, current.width, current.height);
+        overflowSamples = 0;
+        overflowRows = 0;
+    }
+
+    int64_t publishStart = PerfMonitor::Now();
+    p->pixels = p->frames.publish(*ci, *p, &next.width, &next.height);
+    p->histogram.endFrame();
+    // Each consumer gets a pin of its own and copies or stacks the frame on its own thread
+    const SEMFrameSnapshot *frame;
+    if (writer && writer->shouldWrite && (frame = p->frames.pinJustPublished())) {
+        writer->queueSnapshot(p->frames, frame);
+    }
+    if (stacker && stacker->isStacking() && (frame = p->frames.pinJustPublished())) {
+        stacker->queueFrame(p->frames, frame);
+    }
+    saveRequestedFrame();
+    int64_t publishTime = PerfMonitor::Now() - publishStart;
+    PerfMonitor::Instance()->record(PERF_PUBLISH, publishTime);
+    publishNanoseconds += publishTime;
+    PerfMonitor::Instance()->count(PERF_FRAMES_PUBLISHED);
+    if (next.width != current.width || next.height != current.height) {
+        Logger::Instance()->log("[INFO] Frame size changed from %dx%d to %dx%d (scan mode %d)", current.width,
+                                current.height, next.width, next.height, ci->scanMode);
+        ci->sourceWidth = next.width;
+        ci->sourceHeight = next.height;
+    }
+    if (writer && !savingFrame && saveNextFrame.exchange(false)) {
+        // The frame that starts now is the one to save
+        savingFrame = true;
+    }
+    p->x = 0;
+    p->y = 0;
+    p->frameNumber.fetch_add(1, std::memory_order_release);
+}
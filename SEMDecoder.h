@@ -0,0 +1,77 @@
+#ifndef S2500_IMAGE_VIEWER_SEMDECODER_H
+#define S2500_IMAGE_VIEWER_SEMDECODER_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include "sem_capture_info.h"
+#include "sem_capture_pixels.h"
+#include "sem_frame_snapshot.h"
+#include "DecodeKernels.h"
+#include "FrameGeometryTracker.h"
+
+#define MAX_ADC_VAL 8192
+
+class SequenceWriter;
+class FrameStacker;
+
+/**
+ * Decode stage. Runs on its own thread, draining the SEMCapture's sample ring and writing pixels into the
+ * SEMCapturePixels frame store as fast as the samples arrive, independent of the UI frame rate.
+ *
+ * The parser is incremental: sync packets and samples that straddle two chunks are carried over, so the byte
+ * stream can be cut into chunks of any size.
+ *
+ * "Save next frame" takes the frame that starts at the frame sync after saveNextFrame is set. When it's published, the
+ * decoder pins it in the frame store and hands it to the SequenceWriter like a sequence frame, except that it's never
+ * dropped. The decoder copies nothing for it and nothing is locked against the UI.
+ *
+ * The frame size isn't configured: the decoder measures the frames as they come (see FrameGeometryTracker) and moves
+ * to a new size at the frame sync where it first applies.
+ */
+class SEMDecoder {
+    private:
+        SEMCapture *ci;
+        SEMCapturePixels *p;
+        SequenceWriter *writer;
+        FrameStacker *stacker = nullptr;
+        const DecodeKernels *kernels;
+        std::thread decodeThread;
+        std::atomic<bool> shouldDecode{false};
+
+        // Stream state carried between chunks
+        uint16_t packet[SYNC_PACKET_SAMPLES];
+        uint32_t packetFill = 0;
+        uint8_t oddByte = 0;
+        bool hasOddByte = false;
+        std::vector<uint16_t> realigned;
+
+        FrameGeometryTracker geometry;
+        uint32_t overflowSamples = 0;   // this frame's samples past the end of a row
+        uint32_t overflowRows = 0;      // and rows past the end of the frame
+        int64_t publishNanoseconds = 0; // spent publishing in this parse(), which isn't counted as decoding
+
+        void decodeLoop();
+        void parseSamples(const uint16_t *buf, uint32_t numSamples);
+        void parseStatusBytes(const uint16_t *packet);
+        void decodeRun(const uint16_t *run, uint32_t count);
+        void saveRequestedFrame();
+        void endFrame(uint8_t scannedMode);
+
+    public:
+        std::atomic<bool> resetMinMax{false};
+        std::atomic<bool> saveNextFrame{false};     // set by the UI, taken at the next frame sync
+        std::atomic<bool> savingFrame{false};       // the requested frame is being scanned, or waits to be published
+
+        SEMDecoder(SEMCapture *ci, SEMCapturePixels *p, SequenceWriter *writer);
+        ~SEMDecoder();
+        void start();
+        void stop();
+        void setKernels(const DecodeKernels *kernels);
+        void setStacker(FrameStacker *stacker);
+        void parse(const uint16_t *buf, ssize_t bytesRead);
+        void resetStream();
+};
+
+#endif //S2500_IMAGE_VIEWER_SEMDECODER_H
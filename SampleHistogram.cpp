@@ -0,0 +1,124 @@
+#include "SampleHistogram.h"
+#include "DecodeKernels.h"
+#include <cstdlib>
+#include <cstring>
+
+#define HISTOGRAM_BYTES ((SAMPLE_HISTOGRAM_BINS + 1) * sizeof(uint32_t))
+
+SampleHistogram::SampleHistogram() {
+    current = (uint32_t *)calloc(SAMPLE_HISTOGRAM_BINS + 1, sizeof(uint32_t));
+    previous = (uint32_t *)calloc(SAMPLE_HISTOGRAM_BINS + 1, sizeof(uint32_t));
+    published = (uint32_t *)calloc(SAMPLE_HISTOGRAM_BINS + 1, sizeof(uint32_t));
+}
+
+SampleHistogram::~SampleHistogram() {
+    free(current);
+    free(previous);
+    free(published);
+}
+
+/**
+ * Counts a run of samples. Decoder only
+ */
+void SampleHistogram::add(const DecodeKernels &kernels, const uint16_t *run, size_t count) {
+    if (count <= skip) {
+        skip -= count;
+        return;
+    }
+    kernels.histogram(run + skip, count - skip, SAMPLE_HISTOGRAM_STEP, SAMPLE_HISTOGRAM_BINS, current);
+    // Carry the stride over into the next run
+    skip = (SAMPLE_HISTOGRAM_STEP - (count - skip) % SAMPLE_HISTOGRAM_STEP) % SAMPLE_HISTOGRAM_STEP;
+}
+
+/**
+ * Decoder only. Publishes every SAMPLE_HISTOGRAM_ROWS rows
+ */
+void SampleHistogram::endRow() {
+    if (++rowsSincePublish >= SAMPLE_HISTOGRAM_ROWS) {
+        publish();
+    }
+}
+
+/**
+ * The frame being scanned becomes the last complete frame. Decoder only
+ */
+void SampleHistogram::endFrame() {
+    uint32_t *finished = current;
+
+    current = previous;
+    previous = finished;
+    memset(current, 0, HISTOGRAM_BYTES);
+    publish();
+}
+
+/**
+ * Forgets everything counted so far, e.g. after the scan settings change. Decoder only
+ */
+void SampleHistogram::reset() {
+    memset(current, 0, HISTOGRAM_BYTES);
+    memset(previous, 0, HISTOGRAM_BYTES);
+    publish();
+}
+
+void SampleHistogram::publish() {
+    std::unique_lock<std::mutex> lock(publishedMutex, std::try_to_lock);
+
+    if (!lock.owns_lock()) {
+        // The UI is reading it; keep rowsSincePublish so the next row tries again
+        return;
+    }
+    for (uint32_t i=0; i<=SAMPLE_HISTOGRAM_BINS; i++) {
+        published[i] = current[i] + previous[i];
+    }
+    rowsSincePublish = 0;
+    version.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * Copies the published histogram out
+ * @param bins SAMPLE_HISTOGRAM_BINS + 1 entries
+ * @return Samples counted in range
+ */
+uint64_t SampleHistogram::copy(uint32_t *bins) {
+    std::lock_guard<std::mutex> lock(publishedMutex);
+
+    memcpy(bins, published, HISTOGRAM_BYTES);
+    return Count(bins, SAMPLE_HISTOGRAM_BINS);
+}
+
+/**
+ * @return The sum of bins[0] to bins[limit - 1]
+ */
+uint64_t SampleHistogram::Count(const uint32_t *bins, uint32_t limit) {
+    uint64_t total = 0;
+
+    for (uint32_t i=0; i<limit; i++) {
+        total += bins[i];
+    }
+    return total;
+}
+
+/**
+ * @param total Count(bins, limit)
+ * @param fraction e.g. 0.001 for the 0.1th percentile
+ * @return The smallest sample value with at least fraction of the counted samples at or below it, or 0 if bins is
+ * empty
+ */
+uint32_t SampleHistogram::Percentile(const uint32_t *bins, uint32_t limit, uint64_t total, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * total);
+    uint64_t seen = 0;
+
+    if (!total) {
+        return 0;
+    }
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (uint32_t i=0; i<limit; i++) {
+        seen += bins[i];
+        if (seen >= rank) {
+            return i;
+        }
+    }
+    return limit - 1;
+}
@@ -0,0 +1,51 @@
+#ifndef S2500_IMAGE_VIEWER_SAMPLEHISTOGRAM_H
+#define S2500_IMAGE_VIEWER_SAMPLEHISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#define SAMPLE_HISTOGRAM_BINS   8192    // one per ADC value, MAX_ADC_VAL
+#define SAMPLE_HISTOGRAM_STEP   31      // the decoder counts every 31st sample. Odd, so it moves across the columns
+#define SAMPLE_HISTOGRAM_ROWS   64      // rows between publishes
+
+struct DecodeKernels;
+
+/**
+ * Histogram of the ADC samples, kept up to date by the decoder as it goes. Counting every sample would cost more
+ * than the rest of decoding put together, so the decoder counts every SAMPLE_HISTOGRAM_STEP'th one: half a million
+ * in a 4096x4096 frame, plenty for percentiles.
+ *
+ * The decoder counts the frame being scanned into a histogram of its own and keeps the last complete one. Every
+ * SAMPLE_HISTOGRAM_ROWS rows it publishes the two added together, so the published histogram always covers at least
+ * a whole frame and doesn't empty out at frame sync. Publishing only try-locks: if the UI is copying the published
+ * histogram out, the decoder skips it and publishes next time.
+ */
+class SampleHistogram {
+    private:
+        // Owned by the decoder. SAMPLE_HISTOGRAM_BINS + 1 bins each; the last collects samples out of range
+        uint32_t *current;                  // the frame being scanned
+        uint32_t *previous;                 // the last complete frame
+        size_t skip = 0;                    // samples until the next one counted
+        uint32_t rowsSincePublish = 0;
+
+        std::mutex publishedMutex;
+        uint32_t *published;                // current + previous, guarded by publishedMutex
+
+        void publish();
+
+    public:
+        std::atomic<uint32_t> version{0};   // bumped on every publish
+
+        SampleHistogram();
+        ~SampleHistogram();
+        void add(const DecodeKernels &kernels, const uint16_t *run, size_t count);
+        void endRow();
+        void endFrame();
+        void reset();
+        uint64_t copy(uint32_t *bins);
+        static uint64_t Count(const uint32_t *bins, uint32_t limit);
+        static uint32_t Percentile(const uint32_t *bins, uint32_t limit, uint64_t total, double fraction);
+};
+
+#endif //S2500_IMAGE_VIEWER_SAMPLEHISTOGRAM_H
@@ -0,0 +1,91 @@
+#include "SampleRing.h"
+
+SampleRing::SampleRing(uint32_t numChunks) {
+    uint32_t n = 1;
+    while (n < numChunks) {
+        n <<= 1;
+    }
+    this->numChunks = n;
+    this->mask = n - 1;
+    this->chunks = new SampleChunk[n];
+}
+
+SampleRing::~SampleRing() {
+    delete[] chunks;
+}
+
+/**
+ * Producer side. Returns the next free chunk, or nullptr if the consumer hasn't caught up and the ring is full.
+ * The chunk isn't visible to the consumer until commitWrite() is called.
+ */
+SampleChunk *SampleRing::acquireWrite() {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= numChunks) {
+        return nullptr;
+    }
+    SampleChunk *chunk = &chunks[h & mask];
+    chunk->data = chunk->storage;
+    return chunk;
+}
+
+void SampleRing::commitWrite() {
+    uint32_t h = head.load(std::memory_order_relaxed) + 1;
+    head.store(h, std::memory_order_release);
+
+    uint32_t fill = h - tail.load(std::memory_order_relaxed);
+    if (fill > highWater.load(std::memory_order_relaxed)) {
+        highWater.store(fill, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Consumer side. Returns the oldest committed chunk, or nullptr if the ring is empty. The chunk stays owned by the
+ * consumer until releaseRead() is called.
+ */
+SampleChunk *SampleRing::peekRead() {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return &chunks[t & mask];
+}
+
+void SampleRing::releaseRead() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void SampleRing::recordOverrun(ssize_t bytesDropped) {
+    overruns.fetch_add(1, std::memory_order_relaxed);
+    overrunBytes.fetch_add(bytesDropped, std::memory_order_relaxed);
+}
+
+/**
+ * Empties the ring and clears the counters. Only safe to call while neither the producer nor the consumer is running.
+ */
+void SampleRing::reset() {
+    head.store(0);
+    tail.store(0);
+    highWater.store(0);
+    overruns.store(0);
+    overrunBytes.store(0);
+}
+
+uint32_t SampleRing::getCapacity() {
+    return numChunks;
+}
+
+uint32_t SampleRing::getFillLevel() {
+    return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+}
+
+uint32_t SampleRing::getHighWater() {
+    return highWater.load(std::memory_order_relaxed);
+}
+
+uint64_t SampleRing::getOverruns() {
+    return overruns.load(std::memory_order_relaxed);
+}
+
+uint64_t SampleRing::getOverrunBytes() {
+    return overrunBytes.load(std::memory_order_relaxed);
+}
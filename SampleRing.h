@@ -0,0 +1,59 @@
+#ifndef S2500_IMAGE_VIEWER_SAMPLERING_H
+#define S2500_IMAGE_VIEWER_SAMPLERING_H
+
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+
+#define SAMPLE_RING_CHUNK_SAMPLES   8192
+#define SAMPLE_RING_CHUNK_BYTES     (SAMPLE_RING_CHUNK_SAMPLES * sizeof(uint16_t))
+#define SAMPLE_RING_DEFAULT_CHUNKS  512 // 8 MB of samples
+
+struct SampleChunk {
+    const uint16_t *data = nullptr; // normally points at storage
+    ssize_t bytes = 0;
+    int64_t committedNanoseconds = 0; // PerfMonitor::Now() when the producer committed it, 0 if it wasn't timed
+    uint16_t storage[SAMPLE_RING_CHUNK_SAMPLES];
+};
+
+/**
+ * Single-producer/single-consumer lock-free ring of sample chunks. The acquisition thread fills chunks with
+ * acquireWrite()/commitWrite() and the parser drains them with peekRead()/releaseRead(). Neither side ever blocks;
+ * when the ring is full the producer is expected to drop the data and report it through recordOverrun().
+ */
+class SampleRing {
+    private:
+        SampleChunk *chunks;
+        uint32_t numChunks; // power of two
+        uint32_t mask;
+
+        // head and tail live on their own cache lines so the two threads don't false-share
+        char pad0[64];
+        std::atomic<uint32_t> head{0}; // next chunk to be written, owned by the producer
+        char pad1[64];
+        std::atomic<uint32_t> tail{0}; // next chunk to be read, owned by the consumer
+        char pad2[64];
+
+        std::atomic<uint32_t> highWater{0};
+        std::atomic<uint64_t> overruns{0};
+        std::atomic<uint64_t> overrunBytes{0};
+
+    public:
+        SampleRing(uint32_t numChunks = SAMPLE_RING_DEFAULT_CHUNKS);
+        ~SampleRing();
+
+        SampleChunk *acquireWrite();
+        void commitWrite();
+        SampleChunk *peekRead();
+        void releaseRead();
+        void recordOverrun(ssize_t bytesDropped);
+        void reset();
+
+        uint32_t getCapacity();
+        uint32_t getFillLevel();
+        uint32_t getHighWater();
+        uint64_t getOverruns();
+        uint64_t getOverrunBytes();
+};
+
+#endif //S2500_IMAGE_VIEWER_SAMPLERING_H
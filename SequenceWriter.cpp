@@ -1,11 +1,26 @@
 #include <cstdio>
 #include "SequenceWriter.h"
 #include "Logger.h"
+#include "PerfMonitor.h"
+#include "SEMDecoder.h"
+#include "FrameStore.h"
+#include "ThreadPool.h"
+#include "TiffWriter.h"
+#include "sem_frame_file.h"
+#include <climits>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <cstdlib>
+#include <utility>
 
 SequenceWriter::SequenceWriter(int sequenceNumber) {
     this->sequenceNumber = sequenceNumber;
+    this->fileSequence = sequenceNumber;
     this->fileNumber = 0;
     this->relativeDirectoryName = (char*)malloc(RELATIVE_DIRECTORY_NAME_LENGTH_BYTES);
     struct stat st = {0};
@@ -30,72 +45,717 @@ SequenceWriter::SequenceWriter(int sequenceNumber) {
 }
 
 SequenceWriter::~SequenceWriter() {
+    stop();
+    delete encodePool;
+    for (SEMFrameSnapshot *snapshot : freeSnapshots) {
+        free(snapshot->pixels);
+        delete snapshot;
+    }
     free(this->relativeDirectoryName);
 }
 
+void SequenceWriter::start() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (running) {
+        return;
+    }
+    running = true;
+    intakeRunning = true;
+    ioThread = std::thread(&SequenceWriter::ioLoop, this);
+    intakeThread = std::thread(&SequenceWriter::intakeLoop, this);
+}
+
+/**
+ * Stops the intake thread once it has taken in every frame it was given, then the I/O thread once it has written out
+ * everything still in the queue
+ */
+void SequenceWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!running) {
+            return;
+        }
+        intakeRunning = false;
+    }
+    intakeNotEmpty.notify_all();
+    intakeNotFull.notify_all();
+    intakeThread.join();
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        running = false;
+    }
+    queueNotEmpty.notify_all();
+    queueNotFull.notify_all();
+    ioThread.join();
+}
+
+/**
+ * Queues a published frame to be saved as the next file in the sequence, without touching its pixels: the intake
+ * thread copies or spills it and unpins it. If the writer already holds SEQUENCE_WRITER_PINNED_FRAMES frames, the
+ * oldest sequence frame still waiting is dropped to make room, unless the policy is to block.
+ * @param frames The store the frame is pinned in
+ * @param frame Pinned by the caller, for the writer to unpin
+ */
+void SequenceWriter::queueSnapshot(FrameStore &frames, const SEMFrameSnapshot *frame) {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    if (framesPinned >= SEQUENCE_WRITER_PINNED_FRAMES) {
+        if (backpressure == BACKPRESSURE_BLOCK) {
+            intakeNotFull.wait(lock, [this] {
+                return framesPinned < SEQUENCE_WRITER_PINNED_FRAMES || !intakeRunning;
+            });
+        } else {
+            for (auto it = intake.begin(); it != intake.end(); ++it) {
+                if (!it->requested) {
+                    it->store->unpin(it->frame);
+                    intake.erase(it);
+                    framesPinned--;
+                    framesDropped++;
+                    break;
+                }
+            }
+        }
+    }
+    if (!intakeRunning) {
+        frames.unpin(frame);
+        framesDropped++;
+        return;
+    }
+    intake.push_back({&frames, frame, sequenceNumber, false});
+    framesPinned++;
+    lock.unlock();
+    intakeNotEmpty.notify_one();
+}
+
+/**
+ * Queues a published frame that was asked for explicitly ("Save next frame"). Like queueSnapshot() the caller does
+ * no copying, but the frame is never dropped or spilled: the intake thread always copies it into memory, whatever the
+ * backpressure policy and however full the queue is.
+ * @param frames The store the frame is pinned in
+ * @param frame Pinned by the caller, for the writer to unpin
+ */
+void SequenceWriter::queueRequestedSnapshot(FrameStore &frames, const SEMFrameSnapshot *frame) {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    if (!intakeRunning) {
+        frames.unpin(frame);
+        framesDropped++;
+        lock.unlock();
+        std::lock_guard<std::mutex> requestedLock(requestedMutex);
+        lastRequestedFileName[0] = '\0';
+        requestedFramesFinished++;
+        return;
+    }
+    intake.push_back({&frames, frame, sequenceNumber, true});
+    framesPinned++;
+    lock.unlock();
+    intakeNotEmpty.notify_one();
+}
+
 /**
- * Given a valid SEMCapature and SEMCapturePixels, opens the next image in the sequence in the target directory
- * and writes it. Returns the relative file path and name to the saved file.
- *
- * If the returned fileName isn't an empty string it MUST BE free()'d BY THE CALLING FUNCTION
- *
- * @param captureInfo
- * @param pixels
- * @return Either a pointer to the null-terminated fileName char array (max 64 chars) which MUST BE FREED BY THE CALLER.
- * or an empty string in the case of an error (which shouldn't be freed)
+ * Queues a frame the caller filled in a buffer of its own, without copying it: the snapshot's pixel buffer is swapped
+ * for a spare one from the free list, which the caller can fill next time. Frames queued this way were asked for
+ * explicitly, so they're always kept in memory and never dropped by the backpressure policy.
+ * @param frame Pixels and capture state; comes back with a different (possibly empty) buffer
  */
-char *SequenceWriter::saveNextFileInSequence(SEMCapture &captureInfo, SEMCapturePixels &pixels) {
+void SequenceWriter::queueOwnedSnapshot(SEMFrameSnapshot &frame) {
+    SEMFrameSnapshot *snapshot;
+
+    std::unique_lock<std::mutex> lock(queueMutex);
+    snapshot = acquireSnapshot(0);
+    std::swap(*snapshot, frame);
+    snapshot->sequenceNumber = sequenceNumber;
+    snapshot->spilled = false;
+    framesInMemory++;
+    queue.push_back(snapshot);
+    queueDepth = queue.size();
+    lock.unlock();
+    queueNotEmpty.notify_one();
+}
+
+void SequenceWriter::ioLoop() {
+    SEMFrameSnapshot *snapshot;
+    bool inMemory;
+
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true) {
+        queueNotEmpty.wait(lock, [this] { return !queue.empty() || !running; });
+        if (queue.empty()) {
+            break;
+        }
+        snapshot = queue.front();
+        queue.pop_front();
+        queueDepth = queue.size();
+        lock.unlock();
+
+        inMemory = !snapshot->spilled;
+        if (inMemory || unspill(snapshot)) {
+            lock.lock();
+            if (snapshot->sequenceNumber != fileSequence) {
+                fileSequence = snapshot->sequenceNumber;
+                fileNumber = 0;
+            }
+            snapshot->fileNumber = fileNumber++;
+            lock.unlock();
+
+            auto writeStart = std::chrono::steady_clock::now();
+            if (writeFrame(*snapshot)) {
+                framesWritten++;
+            }
+            auto writeTime = std::chrono::steady_clock::now() - writeStart;
+            lastWriteMilliseconds = std::chrono::duration<double, std::milli>(writeTime).count();
+            PerfMonitor::Instance()->record(PERF_WRITE,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(writeTime).count());
+        } else {
+            framesDropped++;
+        }
+
+        lock.lock();
+        if (inMemory) {
+            framesInMemory--;
+        }
+        releaseSnapshot(snapshot);
+        queueNotFull.notify_all();
+    }
+}
+
+/**
+ * Takes in the frames queueSnapshot() and queueRequestedSnapshot() were given: copies each one into the queue, or
+ * spills it when the queue is full and that's the policy, then unpins it
+ */
+void SequenceWriter::intakeLoop() {
+    PinnedFrame pinned;
+    SEMFrameSnapshot *snapshot;
+    uint16_t *buffer;
+    size_t capacity;
+    size_t samples;
+    bool spilling;
+    bool kept;
+
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true) {
+        intakeNotEmpty.wait(lock, [this] { return !intake.empty() || !intakeRunning; });
+        if (intake.empty()) {
+            break;
+        }
+        pinned = intake.front();
+        intake.pop_front();
+        samples = (size_t)pinned.frame->width * pinned.frame->height;
+        spilling = false;
+        if (framesInMemory >= queueCapacity && !pinned.requested) {
+            switch (backpressure.load()) {
+                case BACKPRESSURE_DROP_OLDEST:
+                    dropOldest();
+                    break;
+                case BACKPRESSURE_BLOCK:
+                    queueNotFull.wait(lock, [this] { return framesInMemory < queueCapacity || !running; });
+                    break;
+                case BACKPRESSURE_SPILL:
+                    spilling = true;
+                    break;
+            }
+        }
+        snapshot = acquireSnapshot(spilling ? 0 : samples);
+        if (!spilling) {
+            framesInMemory++;
+        }
+        buffer = snapshot->pixels;
+        capacity = snapshot->capacity;
+        *snapshot = *pinned.frame;
+        snapshot->pixels = buffer;
+        snapshot->capacity = capacity;
+        snapshot->sequenceNumber = pinned.sequenceNumber;
+        snapshot->requested = pinned.requested;
+        snapshot->spilled = spilling;
+        if (spilling) {
+            snapshot->spillNumber = spillNumber++;
+        }
+        lock.unlock();
+
+        if (spilling) {
+            // Straight from the frame store to the page cache; the I/O thread reads it back when it gets to it
+            kept = spill(snapshot, pinned.frame->pixels);
+        } else {
+            memcpy(snapshot->pixels, pinned.frame->pixels, samples * sizeof(uint16_t));
+            kept = true;
+        }
+        pinned.store->unpin(pinned.frame);
+
+        lock.lock();
+        framesPinned--;
+        intakeNotFull.notify_all();
+        if (!kept) {
+            framesDropped++;
+            releaseSnapshot(snapshot);
+            continue;
+        }
+        if (spilling) {
+            framesSpilled++;
+        }
+        queue.push_back(snapshot);
+        queueDepth = queue.size();
+        queueNotEmpty.notify_one();
+    }
+}
+
+/**
+ * Takes a snapshot from the free list, or makes a new one. queueMutex must be held.
+ * @param samples Pixels the snapshot needs room for
+ */
+SEMFrameSnapshot *SequenceWriter::acquireSnapshot(size_t samples) {
+    SEMFrameSnapshot *snapshot;
+
+    if (freeSnapshots.empty()) {
+        snapshot = new SEMFrameSnapshot();
+    } else {
+        snapshot = freeSnapshots.back();
+        freeSnapshots.pop_back();
+    }
+    if (snapshot->capacity < samples) {
+        free(snapshot->pixels);
+        snapshot->pixels = (uint16_t*)malloc(samples * sizeof(uint16_t));
+        snapshot->capacity = samples;
+    }
+    return snapshot;
+}
+
+/**
+ * Returns a snapshot to the free list, keeping no more than a queue's worth of frame buffers around. queueMutex must
+ * be held.
+ */
+void SequenceWriter::releaseSnapshot(SEMFrameSnapshot *snapshot) {
+    if (freeSnapshots.size() > (size_t)queueCapacity) {
+        free(snapshot->pixels);
+        delete snapshot;
+        return;
+    }
+    freeSnapshots.push_back(snapshot);
+}
+
+/**
+ * Discards the oldest frame held in memory to make room for a new one. queueMutex must be held.
+ */
+void SequenceWriter::dropOldest() {
+    for (auto it = queue.begin(); it != queue.end(); ++it) {
+        if (!(*it)->spilled && !(*it)->requested) {
+            releaseSnapshot(*it);
+            queue.erase(it);
+            framesInMemory--;
+            framesDropped++;
+            break;
+        }
+    }
+    queueDepth = queue.size();
+}
+
+/**
+ * Writes the raw samples of a frame that didn't fit in the queue to <sequence>/<file>.spill
+ * @param snapshot Header of the frame; its pixels aren't used
+ * @param pixels The frame's samples
+ * @return True if the whole frame was written
+ */
+bool SequenceWriter::spill(SEMFrameSnapshot *snapshot, const uint16_t *pixels) {
+    char fileName[256];
+    size_t remaining = (size_t)snapshot->width * snapshot->height * sizeof(uint16_t);
+    const char *data = reinterpret_cast<const char *>(pixels);
+    ssize_t written;
+    int fd;
+
+    makeSequenceDirectory(snapshot->sequenceNumber);
+    spillFileName(*snapshot, fileName, sizeof(fileName));
+    fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (fd < 0) {
+        Logger::Instance()->log("Unable to open spill file %s: %s", fileName, strerror(errno));
+        return false;
+    }
+    while (remaining > 0) {
+        written = write(fd, data, remaining);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            Logger::Instance()->log("Unable to write spill file %s: %s", fileName, strerror(errno));
+            close(fd);
+            unlink(fileName);
+            return false;
+        }
+        data += written;
+        remaining -= written;
+    }
+    close(fd);
+    return true;
+}
+
+/**
+ * Reads a spilled frame back into the snapshot and deletes the spill file
+ * @param snapshot
+ * @return True if the frame is back in memory
+ */
+bool SequenceWriter::unspill(SEMFrameSnapshot *snapshot) {
     char fileName[256];
+    size_t samples = (size_t)snapshot->width * snapshot->height;
+    size_t remaining = samples * sizeof(uint16_t);
+    char *data;
+    ssize_t bytes;
+    int fd;
+
+    if (snapshot->capacity < samples) {
+        free(snapshot->pixels);
+        snapshot->pixels = (uint16_t*)malloc(samples * sizeof(uint16_t));
+        snapshot->capacity = samples;
+    }
+    data = reinterpret_cast<char *>(snapshot->pixels);
+
+    spillFileName(*snapshot, fileName, sizeof(fileName));
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        Logger::Instance()->log("Unable to open spill file %s: %s", fileName, strerror(errno));
+        return false;
+    }
+    while (remaining > 0) {
+        bytes = read(fd, data, remaining);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            Logger::Instance()->log("Spill file %s is short", fileName);
+            break;
+        }
+        data += bytes;
+        remaining -= bytes;
+    }
+    close(fd);
+    unlink(fileName);
+    snapshot->spilled = false;
+    return remaining == 0;
+}
+
+void SequenceWriter::makeSequenceDirectory(int sequence) {
+    char directoryName[256];
     struct stat st = {0};
-    FILE *imageFile;
 
-    snprintf(fileName, sizeof(fileName), "%s/%d", relativeDirectoryName, sequenceNumber);
-    if (stat(fileName, &st) == -1) {
-        Logger::Instance()->log("Want to mkdir %s", fileName);
-        mkdir(fileName, 0750);
+    snprintf(directoryName, sizeof(directoryName), "%s/%d", relativeDirectoryName, sequence);
+    if (stat(directoryName, &st) == -1) {
+        Logger::Instance()->log("Want to mkdir %s", directoryName);
+        mkdir(directoryName, 0750);
+    }
+}
+
+void SequenceWriter::spillFileName(const SEMFrameSnapshot &snapshot, char *fileName, size_t length) {
+    snprintf(fileName, length, "%s/%d/%04d.spill", relativeDirectoryName, snapshot.sequenceNumber,
+             snapshot.spillNumber);
+}
+
+/**
+ * Writes every byte described by iov, carrying on after short writes
+ * @return True on success, false with errno set otherwise
+ */
+static bool WriteFully(int fd, struct iovec *iov, int count) {
+    ssize_t written;
+
+    while (count > 0) {
+        written = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            return false;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes a snapshot to its file in the sequence directory, in the current format. Runs on the I/O thread.
+ * @param snapshot
+ * @return True if the file was written
+ */
+bool SequenceWriter::writeFrame(SEMFrameSnapshot &snapshot) {
+    char fileName[256];
+    FrameFormat frameFormat = format;
+    const char *extension;
+    bool written;
+
+    switch (frameFormat) {
+        case FRAME_FORMAT_PPM:
+            extension = "ppm";
+            break;
+        case FRAME_FORMAT_TIFF_DEFLATE:
+        case FRAME_FORMAT_TIFF_DEFLATE_PREDICTOR:
+            extension = "tif";
+            break;
+        case FRAME_FORMAT_PNG:
+            extension = "png";
+            break;
+        case FRAME_FORMAT_RAW16:
+        default:
+            extension = "s2r";
+            break;
     }
 
-    if (snprintf(fileName, sizeof(fileName), "%s/%d/%0.4d.ppm", relativeDirectoryName, sequenceNumber, fileNumber) == -1) {
+    makeSequenceDirectory(snapshot.sequenceNumber);
+    if (snprintf(fileName, sizeof(fileName), "%s/%d/%04d.%s", relativeDirectoryName, snapshot.sequenceNumber,
+                 snapshot.fileNumber, extension) == -1) {
         fileName[sizeof(fileName) - 1] = '\0';
     };
     Logger::Instance()->log("Want to save capture to %s", fileName);
 
-    imageFile = fopen(fileName, "wb");
-    if (!imageFile) {
-        Logger::Instance()->log("Unable to open image file %s!", fileName);
-        snprintf(fileName, 1, "\0");
-    } else {
-        fprintf(imageFile, "P6\n");
-        fprintf(imageFile, "%d %d\n", captureInfo.sourceWidth, captureInfo.sourceHeight);
-        fprintf(imageFile, "255\n"); // max value
+    lastFrameBytes = (uint64_t)snapshot.width * snapshot.height * sizeof(uint16_t);
+    switch (frameFormat) {
+        case FRAME_FORMAT_PPM:
+            written = writePPM(snapshot, fileName);
+            break;
+        case FRAME_FORMAT_TIFF_DEFLATE:
+            written = writeTiff(snapshot, fileName, false);
+            break;
+        case FRAME_FORMAT_TIFF_DEFLATE_PREDICTOR:
+            written = writeTiff(snapshot, fileName, true);
+            break;
+        case FRAME_FORMAT_PNG:
+            written = writePng(snapshot, fileName);
+            break;
+        case FRAME_FORMAT_RAW16:
+        default:
+            written = writeRaw16(snapshot, fileName);
+            break;
+    }
+    if (written && !snapshot.drift.empty()) {
+        writeDriftTable(snapshot);
+    }
+    if (snapshot.requested) {
+        std::lock_guard<std::mutex> lock(requestedMutex);
+        snprintf(lastRequestedFileName, sizeof(lastRequestedFileName), "%s", written ? fileName : "");
+        requestedFramesFinished++;
+    }
+    return written;
+}
+
+/**
+ * Writes a stack's per-frame drift next to it as NNNN.drift.csv. A stack that was saved is kept even if this fails.
+ * @param snapshot
+ * @return True if the whole table was written
+ */
+bool SequenceWriter::writeDriftTable(const SEMFrameSnapshot &snapshot) {
+    char fileName[256];
+    FILE *table;
+    bool written = true;
 
-        for (int i=0; i<captureInfo.sourceWidth * captureInfo.sourceHeight * 4; i+=4) {
-            fwrite(pixels.pixels + i, 1, 3, imageFile);
+    if (snprintf(fileName, sizeof(fileName), "%s/%d/%04d.drift.csv", relativeDirectoryName, snapshot.sequenceNumber,
+                 snapshot.fileNumber) == -1) {
+        fileName[sizeof(fileName) - 1] = '\0';
+    }
+    table = fopen(fileName, "w");
+    if (!table) {
+        Logger::Instance()->log("Unable to open drift table %s!", fileName);
+        return false;
+    }
+    written = fprintf(table, "frame,dx,dy,peak,stacked\n") > 0;
+    for (const FrameDrift &drift : snapshot.drift) {
+        if (!written) {
+            break;
         }
+        written = fprintf(table, "%u,%.3f,%.3f,%.4f,%d\n", drift.frameNumber, drift.driftX, drift.driftY, drift.peak,
+                          drift.stacked ? 1 : 0) > 0;
+    }
+    if (fclose(table) != 0) {
+        written = false;
+    }
+    if (!written) {
+        Logger::Instance()->log("Unable to write drift table %s: %s", fileName, strerror(errno));
+    }
+    return written;
+}
+
+/**
+ * Creates fileName and writes the buffers in iov to it
+ * @return True if the whole file was written
+ */
+bool SequenceWriter::writeFile(const char *fileName, struct iovec *iov, int count) {
+    uint64_t bytes = 0;
+    int fd;
 
-//        fwrite(pixels.pixels, 4, captureInfo.sourceWidth * captureInfo.sourceHeight, imageFile);
-        fclose(imageFile);
+    for (int i=0; i<count; i++) {
+        bytes += iov[i].iov_len;
+    }
+    fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (fd < 0) {
+        Logger::Instance()->log("Unable to open image file %s!", fileName);
+        return false;
+    }
+    if (!WriteFully(fd, iov, count)) {
+        Logger::Instance()->log("Unable to write image file %s: %s", fileName, strerror(errno));
+        close(fd);
+        return false;
+    }
+    close(fd);
+    lastFileBytes = bytes;
+    return true;
+}
+
+/**
+ * Writes the snapshot's samples untouched behind a SEMFrameFileHeader, header and pixels in one writev()
+ * @param snapshot
+ * @param fileName
+ * @return True if the file was written
+ */
+bool SequenceWriter::writeRaw16(const SEMFrameSnapshot &snapshot, const char *fileName) {
+    char header[SEM_FRAME_FILE_HEADER_BYTES] = {0};
+    SEMFrameFileHeader *h = reinterpret_cast<SEMFrameFileHeader *>(header);
+    struct iovec iov[2];
+
+    memcpy(h->magic, SEM_FRAME_FILE_MAGIC, sizeof(h->magic));
+    h->version = SEM_FRAME_FILE_VERSION;
+    h->headerBytes = SEM_FRAME_FILE_HEADER_BYTES;
+    h->width = snapshot.width;
+    h->height = snapshot.height;
+    h->bitsPerSample = 16;
+    h->adcMax = MAX_ADC_VAL;
+    h->frameNumber = snapshot.frameNumber;
+    h->syncNum = snapshot.syncNum;
+    h->sequenceNumber = snapshot.sequenceNumber;
+    h->fileNumber = snapshot.fileNumber;
+    h->min = snapshot.min;
+    h->max = snapshot.max;
+    h->scanMode = snapshot.scanMode;
+    h->timestampNanoseconds = snapshot.timestampNanoseconds;
+    h->frameDuration = snapshot.frameDuration;
+    h->minSync = snapshot.minSync;
+    h->maxSync = snapshot.maxSync;
+    h->syncAverage = snapshot.syncAverage;
+    h->stackedFrames = snapshot.stackedFrames;
+    h->driftX = snapshot.driftX;
+    h->driftY = snapshot.driftY;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = snapshot.pixels;
+    iov[1].iov_len = (size_t)snapshot.width * snapshot.height * sizeof(uint16_t);
+
+    return writeFile(fileName, iov, 2);
+}
+
+/**
+ * Writes a deflate-compressed 16-bit TIFF, compressed in strips on all cores
+ * @param snapshot
+ * @param fileName
+ * @param predictor Use horizontal differencing
+ * @return True if the file was written
+ */
+bool SequenceWriter::writeTiff(const SEMFrameSnapshot &snapshot, const char *fileName, bool predictor) {
+    if (!tiffWriter.encode(snapshot, predictor, compressionLevel, getEncodePool(), encodedBuffers)) {
+        return false;
+    }
+    return writeFile(fileName, encodedBuffers.data(), encodedBuffers.size());
+}
+
+/**
+ * Writes a 16-bit PNG, deflated in strips on all cores
+ * @param snapshot
+ * @param fileName
+ * @return True if the file was written
+ */
+bool SequenceWriter::writePng(const SEMFrameSnapshot &snapshot, const char *fileName) {
+    if (!pngWriter.encode(snapshot, compressionLevel, getEncodePool(), encodedBuffers)) {
+        return false;
+    }
+    return writeFile(fileName, encodedBuffers.data(), encodedBuffers.size());
+}
 
-        fileNumber += 1;
+/**
+ * The pool the compressed formats share. I/O thread only.
+ */
+ThreadPool &SequenceWriter::getEncodePool() {
+    if (!encodePool) {
+        encodePool = new ThreadPool();
+    }
+    return *encodePool;
+}
+
+/**
+ * Writes the frame as an 8-bit PPM
+ * @param snapshot
+ * @param fileName
+ * @return True if the whole file was written
+ */
+bool SequenceWriter::writePPM(const SEMFrameSnapshot &snapshot, const char *fileName) {
+    FILE *imageFile;
+    bool written = true;
+
+    imageFile = fopen(fileName, "wb");
+    if (!imageFile) {
+        Logger::Instance()->log("Unable to open image file %s!", fileName);
+        return false;
     }
+    fprintf(imageFile, "P6\n");
+    fprintf(imageFile, "%d %d\n", snapshot.width, snapshot.height);
+    fprintf(imageFile, "255\n"); // max value
 
-    return strdup(fileName);
+    // The snapshot holds raw samples, so normalize against the running max the same way the live view does
+    uint8_t *row = (uint8_t*)malloc(snapshot.width * 3);
+    uint32_t max = snapshot.max == 0 ? 1 : snapshot.max;
+    uint32_t val;
+    for (int y=0; y<snapshot.height && written; y++) {
+        uint16_t *samples = snapshot.pixels + (y * snapshot.width);
+        for (int x=0; x<snapshot.width; x++) {
+            val = (samples[x] * 255) / max;
+            if (val > 255) {
+                val = 255;
+            }
+            row[x*3]        = val; // R
+            row[x*3 + 1]    = val; // G
+            row[x*3 + 2]    = val; // B
+        }
+        written = fwrite(row, 1, snapshot.width * 3, imageFile) == (size_t)snapshot.width * 3;
+    }
+    free(row);
+    long bytes = ftell(imageFile);
+    // A full disk can show up only when the last of the buffer is flushed
+    if (fclose(imageFile) != 0) {
+        written = false;
+    }
+    if (!written) {
+        Logger::Instance()->log("Unable to write image file %s: %s", fileName, strerror(errno));
+        return false;
+    }
+    lastFileBytes = bytes;
+    return true;
 }
 
 void SequenceWriter::IncrementSequenceNumber() {
+    std::lock_guard<std::mutex> lock(queueMutex);
     sequenceNumber += 1;
-    fileNumber = 0;
 }
 
 
+/**
+ * @return The number the next file written to the current sequence will get
+ */
 int SequenceWriter::getCurrentFileNum() {
-    return fileNumber;
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return fileSequence == sequenceNumber ? fileNumber : 0;
 }
 
 int SequenceWriter::getCurrentSequenceNum() {
+    std::lock_guard<std::mutex> lock(queueMutex);
     return sequenceNumber;
 }
 
 char* SequenceWriter::getCurrentDirectoryName() {
     return relativeDirectoryName;
 }
+
+/**
+ * @param fileName Receives the file the last "Save next frame" went to, or an empty string if it couldn't be written
+ * @param length
+ */
+void SequenceWriter::getLastRequestedFileName(char *fileName, size_t length) {
+    std::lock_guard<std::mutex> lock(requestedMutex);
+    snprintf(fileName, length, "%s", lastRequestedFileName);
+}
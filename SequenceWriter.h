@@ -1,30 +1,135 @@
 #ifndef S2500_IMAGE_VIEWER_SEQUENCEWRITER_H
 #define S2500_IMAGE_VIEWER_SEQUENCEWRITER_H
 
+#include <atomic>
+#include <condition_variable>
 #include <ctime>
-#include "sem_capture_info.h"
-#include "sem_capture_pixels.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+#include "sem_frame_snapshot.h"
+#include "PngWriter.h"
+#include "TiffWriter.h"
 
 #define RELATIVE_DIRECTORY_NAME_LENGTH_BYTES 64
+#define SEQUENCE_WRITER_DEFAULT_QUEUE_FRAMES 4
+#define SEQUENCE_WRITER_PINNED_FRAMES 2 // frame store buffers the writer holds on to, waiting or being copied
 
+class FrameStore;
+class ThreadPool;
+
+enum FrameFormat {
+    FRAME_FORMAT_RAW16,         // .s2r: raw samples plus a SEMFrameFileHeader, see sem_frame_file.h
+    FRAME_FORMAT_PPM,           // 8-bit P6 normalized against the frame's max, for quick viewing
+    FRAME_FORMAT_TIFF_DEFLATE,  // 16-bit TIFF, deflate-compressed in parallel strips
+    FRAME_FORMAT_TIFF_DEFLATE_PREDICTOR, // as above with horizontal differencing: smaller, a little slower
+    FRAME_FORMAT_PNG,           // 16-bit PNG, Sub-filtered and deflated in parallel strips
+};
+
+// What the intake thread does with a frame when the queue already holds queueCapacity frames in memory
+enum WriterBackpressure {
+    BACKPRESSURE_DROP_OLDEST,   // discard the oldest queued frame
+    BACKPRESSURE_BLOCK,         // wait for the I/O thread; once the pinned frames back up, so does the decoder
+    BACKPRESSURE_SPILL,         // dump the raw frame to a spill file and queue it without its pixels
+};
+
+/**
+ * Saves captured frames as numbered files under captures/<date>/<time>/<sequence>/. queueSnapshot() takes a frame
+ * pinned in the frame store and returns at once; an intake thread copies it into a bounded queue, or spills it, and
+ * unpins it, and a background I/O thread drains the queue and does the encoding and writing. The caller does no
+ * copying and no file I/O, so saving never holds up decoding or the capture source.
+ *
+ * Files are numbered as they're written, so frames dropped on the way leave no gaps in a sequence.
+ */
 class SequenceWriter {
     private:
-        int fileNumber = 0;
+        int fileNumber = 0;                 // next file in fileSequence, numbered as frames are written
+        int fileSequence = 0;               // the sequence the I/O thread last wrote to
         int sequenceNumber = 0;
+        int spillNumber = 0;                // names the next spill file
         std::time_t t;
         std::tm *now;
         char *relativeDirectoryName;
 
+        std::thread ioThread;
+        std::mutex queueMutex;
+        std::condition_variable queueNotEmpty;
+        std::condition_variable queueNotFull;
+        std::deque<SEMFrameSnapshot *> queue;
+        std::vector<SEMFrameSnapshot *> freeSnapshots;
+        int framesInMemory = 0;             // queued snapshots still holding their pixels
+        bool running = false;
+
+        struct PinnedFrame {
+            FrameStore *store;
+            const SEMFrameSnapshot *frame;
+            int sequenceNumber;
+            bool requested;                 // by queueRequestedSnapshot(), so never dropped
+        };
+
+        std::thread intakeThread;
+        std::condition_variable intakeNotEmpty;
+        std::condition_variable intakeNotFull;
+        std::deque<PinnedFrame> intake;     // frames waiting to be copied, guarded by queueMutex
+        int framesPinned = 0;               // in intake or being copied
+        bool intakeRunning = false;
+
+        std::mutex requestedMutex;
+        char lastRequestedFileName[256] = {0};
+
+        ThreadPool *encodePool = nullptr;   // compresses TIFF and PNG strips; made on first use by the I/O thread
+        TiffWriter tiffWriter;              // only used on the I/O thread
+        PngWriter pngWriter;
+        std::vector<struct iovec> encodedBuffers;
+
+        void ioLoop();
+        void intakeLoop();
+        SEMFrameSnapshot *acquireSnapshot(size_t samples);
+        void releaseSnapshot(SEMFrameSnapshot *snapshot);
+        void dropOldest();
+        bool spill(SEMFrameSnapshot *snapshot, const uint16_t *pixels);
+        bool unspill(SEMFrameSnapshot *snapshot);
+        void makeSequenceDirectory(int sequence);
+        void spillFileName(const SEMFrameSnapshot &snapshot, char *fileName, size_t length);
+        bool writeFrame(SEMFrameSnapshot &snapshot);
+        bool writeRaw16(const SEMFrameSnapshot &snapshot, const char *fileName);
+        bool writePPM(const SEMFrameSnapshot &snapshot, const char *fileName);
+        bool writeTiff(const SEMFrameSnapshot &snapshot, const char *fileName, bool predictor);
+        bool writePng(const SEMFrameSnapshot &snapshot, const char *fileName);
+        bool writeDriftTable(const SEMFrameSnapshot &snapshot);
+        ThreadPool &getEncodePool();
+        bool writeFile(const char *fileName, struct iovec *iov, int count);
+
     public:
-        bool shouldWrite = false;
+        std::atomic<bool> shouldWrite{false};
+        std::atomic<FrameFormat> format{FRAME_FORMAT_RAW16};
+        std::atomic<int> compressionLevel{1}; // zlib level for the TIFF and PNG formats
+        std::atomic<WriterBackpressure> backpressure{BACKPRESSURE_DROP_OLDEST};
+        std::atomic<int> queueCapacity{SEQUENCE_WRITER_DEFAULT_QUEUE_FRAMES};
+
+        std::atomic<int> queueDepth{0};
+        std::atomic<uint64_t> framesWritten{0};
+        std::atomic<uint64_t> framesDropped{0};
+        std::atomic<uint64_t> framesSpilled{0};
+        std::atomic<double> lastWriteMilliseconds{0};
+        std::atomic<uint64_t> lastFrameBytes{0};  // uncompressed size of the last frame written
+        std::atomic<uint64_t> lastFileBytes{0};   // and the size of its file
+        std::atomic<uint32_t> requestedFramesFinished{0}; // "Save next frame" frames and stacks written or failed
 
         SequenceWriter(int sequenceNumber);
         ~SequenceWriter();
+        void start();
+        void stop();
+        void queueSnapshot(FrameStore &frames, const SEMFrameSnapshot *frame);
+        void queueRequestedSnapshot(FrameStore &frames, const SEMFrameSnapshot *frame);
+        void queueOwnedSnapshot(SEMFrameSnapshot &frame);
         int getCurrentFileNum();
         int getCurrentSequenceNum();
-        char *saveNextFileInSequence(SEMCapture &captureInfo, SEMCapturePixels &pixels);
         void IncrementSequenceNumber();
         char *getCurrentDirectoryName();
+        void getLastRequestedFileName(char *fileName, size_t length);
 };
 
 #endif //S2500_IMAGE_VIEWER_SEQUENCEWRITER_H
@@ -0,0 +1,58 @@
+#include "SerialSource.h"
+#include "Logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+SerialSource::SerialSource(const char *path) {
+    this->path = path;
+}
+
+SerialSource::~SerialSource() {
+    close();
+}
+
+/**
+ * Opens the tty in RW mode and puts it in non-canonical mode with a 1 second read timeout
+ * @return True if the tty was opened
+ */
+bool SerialSource::open() {
+    datafile = ::open(path, O_RDWR, 0);
+    if (datafile == -1) {
+        Logger::Instance()->log("Unable to open file %s!", path);
+        return false;
+    }
+    tcflush(datafile, TCIOFLUSH);
+
+    tcgetattr(datafile, &termios);
+    termios.c_lflag &= ~ICANON;
+    termios.c_cc[VTIME] = 10; // 1 second max blocking time
+    termios.c_cc[VMIN] = 0;   // return even if no chars (idle serial)
+    tcsetattr(datafile, TCSANOW, &termios);
+
+    return true;
+}
+
+void SerialSource::close() {
+    if (datafile != -1) {
+        ::close(datafile);
+        datafile = -1;
+    }
+}
+
+ssize_t SerialSource::read(SampleChunk *chunk) {
+    return ::read(datafile, chunk->storage, SAMPLE_RING_CHUNK_BYTES);
+}
+
+bool SerialSource::isLive() {
+    return true;
+}
+
+bool SerialSource::sendCommand(uint8_t command) {
+    ssize_t bytesWritten = write(datafile, &command, 1);
+    Logger::Instance()->log("num bytes written: %d", bytesWritten);
+    return bytesWritten == 1;
+}
+
+const char *SerialSource::getName() {
+    return path;
+}
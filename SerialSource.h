@@ -0,0 +1,28 @@
+#ifndef S2500_IMAGE_VIEWER_SERIALSOURCE_H
+#define S2500_IMAGE_VIEWER_SERIALSOURCE_H
+
+#include <termios.h>
+#include "CaptureSource.h"
+
+/**
+ * The STM32 capture board's USB CDC tty
+ */
+class SerialSource : public CaptureSource {
+    private:
+        const char *path;
+        int datafile = -1;
+        struct termios termios;
+
+    public:
+        SerialSource(const char *path);
+        ~SerialSource() override;
+
+        bool open() override;
+        void close() override;
+        ssize_t read(SampleChunk *chunk) override;
+        bool isLive() override;
+        bool sendCommand(uint8_t command) override;
+        const char *getName() override;
+};
+
+#endif //S2500_IMAGE_VIEWER_SERIALSOURCE_H
@@ -0,0 +1,155 @@
+#include "SimulatedSource.h"
+#include "Logger.h"
+#include "sem_capture_info.h"
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+SimulatedSource::SimulatedSource(const SimulatedSourceConfig &config) : samplesPerSecond(config.samplesPerSecond) {
+    this->config = config;
+}
+
+SimulatedSource::~SimulatedSource() {
+    close();
+}
+
+/**
+ * Builds the test pattern: a decaying ring pattern over a checkerboard, staying well inside the 13-bit ADC range
+ * @return Always true
+ */
+bool SimulatedSource::open() {
+    double r;
+    double v;
+
+    pattern = new uint16_t[SIMULATED_PATTERN_SIZE * SIMULATED_PATTERN_SIZE];
+    for (int y=0; y<SIMULATED_PATTERN_SIZE; y++) {
+        for (int x=0; x<SIMULATED_PATTERN_SIZE; x++) {
+            r = std::hypot(x - SIMULATED_PATTERN_SIZE/2, y - SIMULATED_PATTERN_SIZE/2);
+            v = 3500 + 2500 * std::cos(r * 0.08) * std::exp(-r / 300);
+            if (((x / 64) + (y / 64)) & 1) {
+                v += 800;
+            }
+            pattern[y * SIMULATED_PATTERN_SIZE + x] = (uint16_t)v;
+        }
+    }
+    frame = 0;
+    row = 0;
+    column = 0;
+    rowStarted = false;
+    pacingClockStarted = false;
+    Logger::Instance()->log("Simulating a %dx%d capture at %f MS/s", config.width, config.height, samplesPerSecond/1e6);
+    return true;
+}
+
+void SimulatedSource::close() {
+    delete[] pattern;
+    pattern = nullptr;
+}
+
+ssize_t SimulatedSource::read(SampleChunk *chunk) {
+    uint16_t *out = chunk->storage;
+    uint32_t n = 0;
+    uint32_t count;
+
+    while (n < SAMPLE_RING_CHUNK_SAMPLES) {
+        if (!rowStarted) {
+            if (SAMPLE_RING_CHUNK_SAMPLES - n < 2 * SYNC_PACKET_SAMPLES) {
+                break;
+            }
+            n += writeRowHeader(out + n);
+            rowStarted = true;
+        }
+
+        count = config.width - column;
+        if (count > SAMPLE_RING_CHUNK_SAMPLES - n) {
+            count = SAMPLE_RING_CHUNK_SAMPLES - n;
+        }
+        writePixels(out + n, count);
+        n += count;
+        column += count;
+
+        if (column == config.width) {
+            column = 0;
+            rowStarted = false;
+            if (++row == config.height) {
+                row = 0;
+                frame++;
+            }
+        }
+    }
+
+    pace(n);
+    samplesGenerated += n;
+    return n * sizeof(uint16_t);
+}
+
+/**
+ * Writes the packets that precede a row: an optional heartbeat block, then a frame sync for the first row or an
+ * X sync for the others
+ * @param out
+ * @return Number of samples written
+ */
+uint32_t SimulatedSource::writeRowHeader(uint16_t *out) {
+    uint32_t n = 0;
+    double rate = samplesPerSecond.load();
+    double rowSeconds = rate > 0 ? config.width / rate : 0;
+    double syncSeconds = 0.001;
+
+    if (config.heartbeatEveryRows && row % config.heartbeatEveryRows == 0) {
+        memset(out, 0, SYNC_PACKET_SAMPLES * sizeof(uint16_t));
+        out[0] = 0xFEFC;
+        n += SYNC_PACKET_SAMPLES;
+    }
+
+    // Same encoding ParseStatusBytes expects: whole seconds then microseconds, row time seconds scaled by 16
+    out[n]     = row == 0 ? 0xFEFB : 0xFEFA;
+    out[n + 1] = (uint16_t)syncSeconds;
+    out[n + 2] = (uint16_t)((syncSeconds - (uint16_t)syncSeconds) * 1e6);
+    out[n + 3] = config.scanMode;
+    out[n + 4] = (uint16_t)((uint16_t)rowSeconds * 16);
+    out[n + 5] = (uint16_t)std::fmin(65535, (rowSeconds - (uint16_t)rowSeconds) * 1e6);
+    return n + SYNC_PACKET_SAMPLES;
+}
+
+void SimulatedSource::writePixels(uint16_t *out, uint32_t count) {
+    const uint32_t mask = SIMULATED_PATTERN_SIZE - 1;
+    uint32_t drift = (uint32_t)(frame * config.driftPixelsPerFrame);
+    const uint16_t *patternRow = pattern + ((row + drift) & mask) * SIMULATED_PATTERN_SIZE;
+    uint32_t x = column + drift;
+
+    for (uint32_t i=0; i<count; i++) {
+        // xorshift32 noise, +/-64 counts
+        noiseState ^= noiseState << 13;
+        noiseState ^= noiseState >> 17;
+        noiseState ^= noiseState << 5;
+        out[i] = patternRow[(x + i) & mask] + (noiseState & 0x7F) - 64;
+    }
+}
+
+/**
+ * Sleeps until numSamples more samples are due at the configured rate. If we fall more than a second behind (the
+ * ring was full, or the rate changed) the schedule restarts from now rather than bursting to catch up.
+ */
+void SimulatedSource::pace(uint32_t numSamples) {
+    double rate = samplesPerSecond.load();
+    auto now = std::chrono::steady_clock::now();
+
+    if (rate <= 0) {
+        pacingClockStarted = false;
+        return;
+    }
+    if (!pacingClockStarted || now - pacingClock > std::chrono::seconds(1)) {
+        pacingClock = now;
+        pacingClockStarted = true;
+    }
+    pacingClock += std::chrono::nanoseconds((int64_t)(numSamples * 1e9 / rate));
+    std::this_thread::sleep_until(pacingClock);
+}
+
+bool SimulatedSource::isLive() {
+    return samplesPerSecond.load() > 0;
+}
+
+const char *SimulatedSource::getName() {
+    return "Simulator";
+}
@@ -0,0 +1,55 @@
+#ifndef S2500_IMAGE_VIEWER_SIMULATEDSOURCE_H
+#define S2500_IMAGE_VIEWER_SIMULATEDSOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include "CaptureSource.h"
+
+#define SIMULATED_PATTERN_SIZE 512 // must be a power of two
+
+struct SimulatedSourceConfig {
+    uint16_t width = 4096;
+    uint16_t height = 4096;
+    uint8_t scanMode = 6;
+    double samplesPerSecond = 1e6;      // 0 for as fast as the decoder will take them
+    uint32_t heartbeatEveryRows = 512;  // 0 for no heartbeats
+    float driftPixelsPerFrame = 0.0f;   // specimen drift, in x and y
+};
+
+/**
+ * Stands in for the STM32 capture board. Emits the real wire protocol: a 0xFEFB frame sync packet before the first
+ * row of each frame, a 0xFEFA X sync packet before every other row, and 0xFEFC heartbeat blocks, with scan mode and
+ * sync/row durations filled in. Pixels are a fixed test pattern plus noise, optionally drifting frame to frame.
+ * Sync packets are never split across chunks.
+ */
+class SimulatedSource : public CaptureSource {
+    private:
+        SimulatedSourceConfig config;
+        uint16_t *pattern = nullptr;
+        uint32_t noiseState = 0x12345678;
+        uint32_t frame = 0;
+        uint32_t row = 0;
+        uint32_t column = 0;
+        bool rowStarted = false;
+        std::chrono::steady_clock::time_point pacingClock;
+        bool pacingClockStarted = false;
+
+        uint32_t writeRowHeader(uint16_t *out);
+        void writePixels(uint16_t *out, uint32_t count);
+        void pace(uint32_t numSamples);
+
+    public:
+        std::atomic<double> samplesPerSecond;
+        std::atomic<uint64_t> samplesGenerated{0};
+
+        SimulatedSource(const SimulatedSourceConfig &config);
+        ~SimulatedSource() override;
+
+        bool open() override;
+        void close() override;
+        ssize_t read(SampleChunk *chunk) override;
+        bool isLive() override;
+        const char *getName() override;
+};
+
+#endif //S2500_IMAGE_VIEWER_SIMULATEDSOURCE_H
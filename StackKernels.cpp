@@ -0,0 +1,170 @@
+#include "StackKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define STACK_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+static void AccumulateScalar(const uint16_t *frame, uint32_t *sum, size_t count) {
+    for (size_t i=0; i<count; i++) {
+        sum[i] += frame[i];
+    }
+}
+
+static void AccumulateClippedScalar(const uint16_t *frame, float *mean, float *m2, float *n, size_t count, float kappa,
+                                    float minFrames) {
+    const float kappa2 = kappa * kappa;
+    float x, c, m, s, delta, spread;
+
+    for (size_t i=0; i<count; i++) {
+        x = frame[i];
+        c = n[i];
+        m = mean[i];
+        s = m2[i];
+        delta = x - m;
+        spread = s > c * STACK_VARIANCE_FLOOR ? s : c * STACK_VARIANCE_FLOOR;
+        // |delta| > kappa * sqrt(m2 / n), without the sqrt or the divide
+        if (c >= minFrames && delta * delta * c > kappa2 * spread) {
+            continue;
+        }
+        c += 1.0f;
+        m += delta / c;
+        s += delta * (x - m);
+        n[i] = c;
+        mean[i] = m;
+        m2[i] = s;
+    }
+}
+
+static void SumToPixelsScalar(const uint32_t *sum, size_t count, uint32_t frames, uint16_t *out) {
+    const float scale = 1.0f / frames;
+    float v;
+
+    for (size_t i=0; i<count; i++) {
+        v = (float)sum[i] * scale + 0.5f;
+        out[i] = v >= 65535.0f ? 65535 : (uint16_t)v;
+    }
+}
+
+static void MeanToPixelsScalar(const float *mean, size_t count, uint16_t *out) {
+    float v;
+
+    for (size_t i=0; i<count; i++) {
+        v = mean[i] + 0.5f;
+        out[i] = v <= 0.0f ? 0 : v >= 65535.0f ? 65535 : (uint16_t)v;
+    }
+}
+
+#ifdef STACK_KERNELS_X86
+
+__attribute__((target("avx2")))
+static void AccumulateAVX2(const uint16_t *frame, uint32_t *sum, size_t count) {
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(frame + i));
+        __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1));
+        __m256i *s = reinterpret_cast<__m256i *>(sum + i);
+        _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s), lo));
+        _mm256_storeu_si256(s + 1, _mm256_add_epi32(_mm256_loadu_si256(s + 1), hi));
+    }
+    AccumulateScalar(frame + i, sum + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void AccumulateClippedAVX2(const uint16_t *frame, float *mean, float *m2, float *n, size_t count, float kappa,
+                                  float minFrames) {
+    const __m256 kappa2 = _mm256_set1_ps(kappa * kappa);
+    const __m256 floor = _mm256_set1_ps(STACK_VARIANCE_FLOOR);
+    const __m256 minimum = _mm256_set1_ps(minFrames);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(frame + i))));
+        __m256 c = _mm256_loadu_ps(n + i);
+        __m256 m = _mm256_loadu_ps(mean + i);
+        __m256 s = _mm256_loadu_ps(m2 + i);
+        __m256 delta = _mm256_sub_ps(x, m);
+        __m256 spread = _mm256_max_ps(s, _mm256_mul_ps(c, floor));
+        __m256 reject = _mm256_and_ps(
+            _mm256_cmp_ps(c, minimum, _CMP_GE_OQ),
+            _mm256_cmp_ps(_mm256_mul_ps(_mm256_mul_ps(delta, delta), c), _mm256_mul_ps(kappa2, spread), _CMP_GT_OQ));
+
+        __m256 c1 = _mm256_add_ps(c, one);
+        __m256 m1 = _mm256_add_ps(m, _mm256_div_ps(delta, c1));
+        __m256 s1 = _mm256_add_ps(s, _mm256_mul_ps(delta, _mm256_sub_ps(x, m1)));
+
+        _mm256_storeu_ps(n + i, _mm256_blendv_ps(c1, c, reject));
+        _mm256_storeu_ps(mean + i, _mm256_blendv_ps(m1, m, reject));
+        _mm256_storeu_ps(m2 + i, _mm256_blendv_ps(s1, s, reject));
+    }
+    AccumulateClippedScalar(frame + i, mean + i, m2 + i, n + i, count - i, kappa, minFrames);
+}
+
+__attribute__((target("avx2")))
+static void SumToPixelsAVX2(const uint32_t *sum, size_t count, uint32_t frames, uint16_t *out) {
+    const __m256 scale = _mm256_set1_ps(1.0f / frames);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 ceiling = _mm256_set1_ps(65535.0f);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(sum + i)));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(sum + i + 8)));
+        a = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(a, scale), half), ceiling);
+        b = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(b, scale), half), ceiling);
+        // packus works within 128-bit lanes, so put the quadwords back in order afterwards
+        __m256i packed = _mm256_packus_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+        packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), packed);
+    }
+    SumToPixelsScalar(sum + i, count - i, frames, out + i);
+}
+
+__attribute__((target("avx2")))
+static void MeanToPixelsAVX2(const float *mean, size_t count, uint16_t *out) {
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 ceiling = _mm256_set1_ps(65535.0f);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256 a = _mm256_add_ps(_mm256_loadu_ps(mean + i), half);
+        __m256 b = _mm256_add_ps(_mm256_loadu_ps(mean + i + 8), half);
+        a = _mm256_min_ps(_mm256_max_ps(a, zero), ceiling);
+        b = _mm256_min_ps(_mm256_max_ps(b, zero), ceiling);
+        __m256i packed = _mm256_packus_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+        packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), packed);
+    }
+    MeanToPixelsScalar(mean + i, count - i, out + i);
+}
+
+#endif // STACK_KERNELS_X86
+
+static const StackKernels scalarKernels = {
+    "scalar", AccumulateScalar, AccumulateClippedScalar, SumToPixelsScalar, MeanToPixelsScalar
+};
+#ifdef STACK_KERNELS_X86
+static const StackKernels avx2Kernels = {
+    "AVX2", AccumulateAVX2, AccumulateClippedAVX2, SumToPixelsAVX2, MeanToPixelsAVX2
+};
+#endif
+
+static const StackKernels *SelectStackKernels() {
+#ifdef STACK_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &avx2Kernels;
+    }
+#endif
+    return &scalarKernels;
+}
+
+const StackKernels &GetStackKernels() {
+    static const StackKernels *kernels = SelectStackKernels();
+    return *kernels;
+}
@@ -0,0 +1,33 @@
+#ifndef S2500_IMAGE_VIEWER_STACKKERNELS_H
+#define S2500_IMAGE_VIEWER_STACKKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define STACK_VARIANCE_FLOOR 1.0f // LSB², so pixels that haven't varied yet don't reject everything
+
+/**
+ * The per-pixel loops of FrameStacker, picked once at startup like DecodeKernels (AVX2 or plain C++). All of them
+ * work on any sub-range of the frame, so the stacker can split a frame across threads.
+ */
+struct StackKernels {
+    const char *name;
+
+    // sum[i] += frame[i]
+    void (*accumulate)(const uint16_t *frame, uint32_t *sum, size_t count);
+
+    // Welford update of mean/m2/n with frame, skipping samples more than kappa sigma from the mean once a pixel has
+    // minFrames samples
+    void (*accumulateClipped)(const uint16_t *frame, float *mean, float *m2, float *n, size_t count, float kappa,
+                              float minFrames);
+
+    // out[i] = round(sum[i] / frames)
+    void (*sumToPixels)(const uint32_t *sum, size_t count, uint32_t frames, uint16_t *out);
+
+    // out[i] = round(mean[i])
+    void (*meanToPixels)(const float *mean, size_t count, uint16_t *out);
+};
+
+const StackKernels &GetStackKernels();
+
+#endif //S2500_IMAGE_VIEWER_STACKKERNELS_H
@@ -0,0 +1,185 @@
+#include "TextureStreamer.h"
+#include "Logger.h"
+#include "PerfMonitor.h"
+#include "sem_frame_snapshot.h"
+
+/**
+ * @param texture To stream into. Allocated at the size frames are expected to be; it's resized to the frames that
+ * actually arrive
+ * @return True if the persistently mapped path is available, false if uploads will come from client memory
+ */
+bool TextureStreamer::init(TiledTexture *texture) {
+    this->texture = texture;
+
+    if (!GLAD_GL_VERSION_4_4 && !GLAD_GL_ARB_buffer_storage) {
+        Logger::Instance()->log("[INFO] No persistent buffer mapping, uploading textures from client memory");
+        return false;
+    }
+    return createBuffer(texture->getSamples() * sizeof(uint16_t));
+}
+
+/**
+ * Creates and maps the upload buffer, leaving nothing bound
+ * @param slotBytes
+ * @return False if it couldn't be mapped, so uploads will come from client memory
+ */
+bool TextureStreamer::createBuffer(size_t slotBytes) {
+    this->slotBytes = slotBytes;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slotBytes * TEXTURE_STREAMER_SLOTS, nullptr, flags);
+    mapped = static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotBytes * TEXTURE_STREAMER_SLOTS, flags));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (!mapped) {
+        Logger::Instance()->log("[ERROR] Unable to map the texture upload buffer, uploading from client memory");
+        glDeleteBuffers(1, &pbo);
+        pbo = 0;
+        return false;
+    }
+    Logger::Instance()->log("[INFO] Streaming texture uploads through %d mapped slots of %.1f MB",
+                            TEXTURE_STREAMER_SLOTS, slotBytes / 1e6);
+    return true;
+}
+
+/**
+ * Resizes the texture to the frame if the frame size has changed, growing the upload buffer if the new size needs
+ * bigger slots; it never shrinks, so going back to a smaller size costs nothing. Called with the upload buffer bound,
+ * if there is one.
+ * @param frame A pinned frame
+ * @return True if the texture was resized, which leaves it empty
+ */
+bool TextureStreamer::fit(const SEMFrameSnapshot *frame) {
+    size_t bytes;
+
+    if (frame->width == texture->getWidth() && frame->height == texture->getHeight()) {
+        return false;
+    }
+    texture->allocate(frame->width, frame->height);
+    bytes = texture->getSamples() * sizeof(uint16_t);
+    if (mapped && bytes > slotBytes) {
+        // GL holds on to the old buffer until the GPU has finished reading from it
+        destroy();
+        currentSlot = 0;
+        if (createBuffer(bytes)) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        }
+    }
+    return true;
+}
+
+/**
+ * Uploads every band of rows the decoder has written since the last call: first what's left of the frames published
+ * since then, from the latest published frame, then, if liveRows is set, what's been scanned of the next one from the
+ * live buffer.
+ * @param frames
+ * @param liveRows False to show only complete frames
+ */
+void TextureStreamer::upload(FrameStore &frames, bool liveRows) {
+    const SEMFrameSnapshot *frame;
+    uint64_t bands;
+    bool published = frames.framesPublished.load() != framesSeen;
+    bool uploaded = false;
+
+    if (!published && !liveRows) {
+        return;
+    }
+    if (mapped && fences[currentSlot]) {
+        if (glClientWaitSync(fences[currentSlot], 0, 0) == GL_TIMEOUT_EXPIRED) {
+            // Still in flight; the bands stay dirty and go up next frame
+            deferredUploads++;
+            return;
+        }
+        glDeleteSync(fences[currentSlot]);
+        fences[currentSlot] = nullptr;
+    }
+    if (mapped) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    }
+
+    if (published && (frame = frames.pinPublished())) {
+        framesSeen = frames.framesPublished.load();
+        bands = frames.takeDirtyBands(frame);
+        if (fit(frame)) {
+            bands = ~0ull;
+        }
+        uploadBands(frame, bands, currentSlot * slotBytes);
+        uploaded |= bands != 0;
+        // The snapshot's timestamp is wall clock, taken when the frame was published
+        PerfMonitor::Instance()->record(PERF_FRAME_AGE, std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() - frame->timestampNanoseconds);
+        PerfMonitor::Instance()->count(PERF_FRAMES_UPLOADED);
+        frames.unpin(frame);
+    }
+    if (liveRows && (frame = frames.pinLive())) {
+        // Rows overlapping the ones just sent share their place in the slot; the live ones are newer either way. After
+        // a resize only the rows scanned at the new size are worth showing
+        bands = frames.takeDirtyBands(frame);
+        fit(frame);
+        uploadBands(frame, bands, currentSlot * slotBytes);
+        uploaded |= bands != 0;
+        frames.unpin(frame);
+    }
+
+    if (mapped) {
+        // Unbind before ImGui renders; its own texture uploads source from client memory
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (uploaded) {
+            fences[currentSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            currentSlot = (currentSlot + 1) % TEXTURE_STREAMER_SLOTS;
+        }
+    }
+}
+
+/**
+ * Sends the given bands of the frame to the texture. Consecutive bands are merged into a single upload.
+ */
+void TextureStreamer::uploadBands(const SEMFrameSnapshot *frame, uint64_t bands, size_t slotOffset) {
+    int32_t bandHeight = FrameStore::BandHeight(frame->height);
+    int firstBand;
+    int lastBand;
+    int firstRow;
+    int numRows;
+
+    while (bands) {
+        firstBand = __builtin_ctzll(bands);
+        lastBand = firstBand;
+        while (lastBand + 1 < DIRTY_BANDS && (bands & (1ull << (lastBand + 1)))) {
+            lastBand++;
+        }
+        bands &= ~(((2ull << lastBand) - 1) & ~((1ull << firstBand) - 1));
+
+        firstRow = firstBand * bandHeight;
+        numRows = (lastBand + 1) * bandHeight - firstRow;
+        if (firstRow + numRows > frame->height) {
+            numRows = frame->height - firstRow;
+        }
+        if (numRows <= 0) {
+            continue;
+        }
+
+        texture->upload(frame->pixels, firstRow, numRows, pbo, mapped, slotOffset);
+    }
+}
+
+void TextureStreamer::destroy() {
+    for (int i=0; i<TEXTURE_STREAMER_SLOTS; i++) {
+        if (fences[i]) {
+            glDeleteSync(fences[i]);
+            fences[i] = nullptr;
+        }
+    }
+    if (pbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+        pbo = 0;
+    }
+    mapped = nullptr;
+}
+
+bool TextureStreamer::isStreaming() {
+    return mapped != nullptr;
+}
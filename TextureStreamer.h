@@ -0,0 +1,44 @@
+#ifndef S2500_IMAGE_VIEWER_TEXTURESTREAMER_H
+#define S2500_IMAGE_VIEWER_TEXTURESTREAMER_H
+
+#include <cstddef>
+#include <glad/glad.h>
+#include "FrameStore.h"
+#include "TiledTexture.h"
+
+#define TEXTURE_STREAMER_SLOTS 3
+
+/**
+ * Streams the rows the decoder has written into the live TiledTexture through a persistently mapped pixel unpack
+ * buffer split into TEXTURE_STREAMER_SLOTS slots, each the size of the frame and its mip levels. Rows are copied into a
+ * free slot and glTexSubImage2D sources them from the buffer, so the GPU does the transfer asynchronously. A fence per
+ * slot keeps us from overwriting a slot the GPU is still reading; if the next slot is still busy the upload is
+ * deferred to the next frame rather than waiting. Falls back to plain client-memory uploads without GL 4.4 /
+ * ARB_buffer_storage.
+ *
+ * The texture follows the size of the frames it's given, so it changes size when the decoder does.
+ */
+class TextureStreamer {
+    private:
+        TiledTexture *texture = nullptr;
+        GLuint pbo = 0;
+        uint8_t *mapped = nullptr;
+        GLsync fences[TEXTURE_STREAMER_SLOTS] = {};
+        int currentSlot = 0;
+        size_t slotBytes = 0;
+        uint32_t framesSeen = 0;
+
+        bool createBuffer(size_t slotBytes);
+        bool fit(const SEMFrameSnapshot *frame);
+        void uploadBands(const SEMFrameSnapshot *frame, uint64_t bands, size_t slotOffset);
+
+    public:
+        uint32_t deferredUploads = 0; // uploads pushed back a frame because the GPU still owned the slot
+
+        bool init(TiledTexture *texture);
+        void upload(FrameStore &frames, bool liveRows);
+        void destroy();
+        bool isStreaming();
+};
+
+#endif //S2500_IMAGE_VIEWER_TEXTURESTREAMER_H
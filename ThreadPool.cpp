@@ -0,0 +1,85 @@
+#include "ThreadPool.h"
+
+/**
+ * @param numThreads Workers to start, not counting the thread that calls parallelFor(). 0 picks one less than the
+ * number of hardware threads
+ */
+ThreadPool::ThreadPool(uint32_t numThreads) {
+    if (numThreads == 0) {
+        numThreads = std::thread::hardware_concurrency();
+        numThreads = numThreads > 1 ? numThreads - 1 : 1;
+    }
+    for (uint32_t i=0; i<numThreads; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    workReady.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+uint32_t ThreadPool::getThreadCount() {
+    return workers.size() + 1;
+}
+
+/**
+ * Calls fn(0) .. fn(count - 1) spread over the pool and the calling thread, and waits for all of them
+ * @param count
+ * @param fn Must be safe to call concurrently for different indices
+ */
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t)> &fn) {
+    if (count == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    job = &fn;
+    jobCount = count;
+    nextIndex = 0;
+    finished = 0;
+    generation++;
+    workReady.notify_all();
+
+    runJobs(lock);
+    workDone.wait(lock, [this] { return finished == jobCount; });
+    job = nullptr;
+}
+
+void ThreadPool::workerLoop() {
+    uint64_t seenGeneration = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        workReady.wait(lock, [this, &seenGeneration] { return quit || generation != seenGeneration; });
+        if (quit) {
+            return;
+        }
+        seenGeneration = generation;
+        runJobs(lock);
+    }
+}
+
+/**
+ * Takes indices of the current job until there are none left. mutex is held on entry and exit but not while the job
+ * runs.
+ */
+void ThreadPool::runJobs(std::unique_lock<std::mutex> &lock) {
+    const std::function<void(uint32_t)> *fn = job;
+    uint32_t i;
+
+    while (nextIndex < jobCount) {
+        i = nextIndex++;
+        lock.unlock();
+        (*fn)(i);
+        lock.lock();
+        if (++finished == jobCount) {
+            workDone.notify_all();
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef S2500_IMAGE_VIEWER_THREADPOOL_H
+#define S2500_IMAGE_VIEWER_THREADPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads for splitting one job into independent pieces, e.g. compressing the strips of a frame.
+ * parallelFor() hands out the piece indices to the workers and the calling thread alike and returns when all of them
+ * are done. Only one thread may call parallelFor() at a time.
+ */
+class ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable workReady;
+        std::condition_variable workDone;
+        const std::function<void(uint32_t)> *job = nullptr;
+        uint32_t jobCount = 0;
+        uint32_t nextIndex = 0;
+        uint32_t finished = 0;
+        uint64_t generation = 0;
+        bool quit = false;
+
+        void workerLoop();
+        void runJobs(std::unique_lock<std::mutex> &lock);
+
+    public:
+        ThreadPool(uint32_t numThreads = 0);
+        ~ThreadPool();
+        uint32_t getThreadCount();
+        void parallelFor(uint32_t count, const std::function<void(uint32_t)> &fn);
+};
+
+#endif //S2500_IMAGE_VIEWER_THREADPOOL_H
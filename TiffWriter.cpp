@@ -0,0 +1,205 @@
+#include "TiffWriter.h"
+#include "ThreadPool.h"
+#include "Logger.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+
+#define TIFF_TYPE_ASCII     2
+#define TIFF_TYPE_SHORT     3
+#define TIFF_TYPE_LONG      4
+
+#define TIFF_COMPRESSION_ADOBE_DEFLATE  8
+#define TIFF_PHOTOMETRIC_MIN_IS_BLACK   1
+#define TIFF_PREDICTOR_NONE             1
+#define TIFF_PREDICTOR_HORIZONTAL       2
+
+struct TiffField {
+    uint16_t tag;
+    uint16_t type;
+    uint32_t count;
+    uint32_t value;             // inline value, or offset of data once it's placed
+    const void *data = nullptr; // out of line value, when it doesn't fit in 4 bytes
+    size_t dataBytes = 0;
+};
+
+static const uint8_t zeroPad = 0;
+
+/**
+ * Compresses the frame and lays out the TIFF. The buffers iov points at belong to the TiffWriter and stay valid until
+ * the next call.
+ * @param snapshot
+ * @param predictor Apply TIFF horizontal differencing before deflate; slower, but noticeably smaller on smooth images
+ * @param level zlib level, 1 (fastest) to 9 (smallest)
+ * @param pool Compresses the strips
+ * @param iov Filled with the pieces of the file, in order
+ * @return True on success
+ */
+bool TiffWriter::encode(const SEMFrameSnapshot &snapshot, bool predictor, int level, ThreadPool &pool,
+                        std::vector<struct iovec> &iov) {
+    uint32_t numStrips = (snapshot.height + TIFF_WRITER_ROWS_PER_STRIP - 1) / TIFF_WRITER_ROWS_PER_STRIP;
+    std::vector<uint8_t> ok(numStrips, 0);
+    size_t offset = sizeof(fileHeader);
+    bool allOk = true;
+
+    if (strips.size() < numStrips) {
+        strips.resize(numStrips);
+        stripBytes.resize(numStrips);
+        differenced.resize(numStrips);
+    }
+
+    pool.parallelFor(numStrips, [&](uint32_t strip) {
+        ok[strip] = compressStrip(snapshot, strip, predictor, level);
+    });
+
+    iov.clear();
+    fileHeader[0] = 'I';
+    fileHeader[1] = 'I';
+    fileHeader[2] = 42;
+    fileHeader[3] = 0;
+    iov.push_back({ fileHeader, sizeof(fileHeader) });
+    for (uint32_t strip=0; strip<numStrips; strip++) {
+        allOk = allOk && ok[strip];
+        iov.push_back({ strips[strip].data(), stripBytes[strip] });
+        offset += stripBytes[strip];
+    }
+    if (!allOk) {
+        Logger::Instance()->log("Unable to compress frame %d", snapshot.fileNumber);
+        return false;
+    }
+    if (offset & 1) {
+        // The directory has to start on a word boundary
+        iov.push_back({ (void*)&zeroPad, 1 });
+        offset++;
+    }
+    if (offset > UINT32_MAX) {
+        Logger::Instance()->log("Frame %d is too big for a TIFF", snapshot.fileNumber);
+        return false;
+    }
+
+    uint32_t directoryOffset = offset;
+    memcpy(fileHeader + 4, &directoryOffset, sizeof(directoryOffset));
+    buildDirectory(snapshot, numStrips, directoryOffset, predictor);
+    iov.push_back({ directory.data(), directory.size() });
+    return true;
+}
+
+bool TiffWriter::compressStrip(const SEMFrameSnapshot &snapshot, uint32_t strip, bool predictor, int level) {
+    uint32_t firstRow = strip * TIFF_WRITER_ROWS_PER_STRIP;
+    uint32_t rows = snapshot.height - firstRow;
+    if (rows > TIFF_WRITER_ROWS_PER_STRIP) {
+        rows = TIFF_WRITER_ROWS_PER_STRIP;
+    }
+    size_t samples = (size_t)rows * snapshot.width;
+    const uint16_t *source = snapshot.pixels + (size_t)firstRow * snapshot.width;
+    uLongf compressedBytes;
+
+    if (predictor) {
+        std::vector<uint16_t> &out = differenced[strip];
+        out.resize(samples);
+        for (uint32_t y=0; y<rows; y++) {
+            const uint16_t *in = source + (size_t)y * snapshot.width;
+            uint16_t *row = out.data() + (size_t)y * snapshot.width;
+            row[0] = in[0];
+            for (uint32_t x=1; x<snapshot.width; x++) {
+                row[x] = in[x] - in[x - 1];
+            }
+        }
+        source = out.data();
+    }
+
+    compressedBytes = compressBound(samples * sizeof(uint16_t));
+    if (strips[strip].size() < compressedBytes) {
+        strips[strip].resize(compressedBytes);
+    }
+    if (compress2(strips[strip].data(), &compressedBytes, reinterpret_cast<const Bytef *>(source),
+                  samples * sizeof(uint16_t), level) != Z_OK) {
+        stripBytes[strip] = 0;
+        return false;
+    }
+    stripBytes[strip] = compressedBytes;
+    return true;
+}
+
+void TiffWriter::buildDirectory(const SEMFrameSnapshot &snapshot, uint32_t numStrips, uint32_t directoryOffset,
+                                bool predictor) {
+    static const char software[] = "S-2500 Capture";
+    char description[512];
+    std::vector<uint32_t> stripOffsets(numStrips);
+    std::vector<uint32_t> stripByteCounts(numStrips);
+    uint32_t offset = 8;
+
+    for (uint32_t strip=0; strip<numStrips; strip++) {
+        stripOffsets[strip] = offset;
+        stripByteCounts[strip] = stripBytes[strip];
+        offset += stripBytes[strip];
+    }
+    FormatFrameDescription(snapshot, description, sizeof(description));
+
+    // Must be sorted by tag
+    TiffField fields[] = {
+        { 256, TIFF_TYPE_LONG, 1, snapshot.width },                              // ImageWidth
+        { 257, TIFF_TYPE_LONG, 1, snapshot.height },                             // ImageLength
+        { 258, TIFF_TYPE_SHORT, 1, 16 },                                         // BitsPerSample
+        { 259, TIFF_TYPE_SHORT, 1, TIFF_COMPRESSION_ADOBE_DEFLATE },             // Compression
+        { 262, TIFF_TYPE_SHORT, 1, TIFF_PHOTOMETRIC_MIN_IS_BLACK },              // PhotometricInterpretation
+        { 270, TIFF_TYPE_ASCII, (uint32_t)strlen(description) + 1, 0 },          // ImageDescription
+        { 273, TIFF_TYPE_LONG, numStrips, 0 },                                   // StripOffsets
+        { 277, TIFF_TYPE_SHORT, 1, 1 },                                          // SamplesPerPixel
+        { 278, TIFF_TYPE_LONG, 1, TIFF_WRITER_ROWS_PER_STRIP },                  // RowsPerStrip
+        { 279, TIFF_TYPE_LONG, numStrips, 0 },                                   // StripByteCounts
+        { 284, TIFF_TYPE_SHORT, 1, 1 },                                          // PlanarConfiguration
+        { 305, TIFF_TYPE_ASCII, sizeof(software), 0 },                           // Software
+        { 317, TIFF_TYPE_SHORT, 1, (uint32_t)(predictor ? TIFF_PREDICTOR_HORIZONTAL : TIFF_PREDICTOR_NONE) }, // Predictor
+        { 339, TIFF_TYPE_SHORT, 1, 1 },                                          // SampleFormat (unsigned)
+    };
+    const uint16_t numFields = sizeof(fields) / sizeof(fields[0]);
+    fields[5].data = description;
+    fields[5].dataBytes = fields[5].count;
+    fields[6].data = stripOffsets.data();
+    fields[6].dataBytes = numStrips * sizeof(uint32_t);
+    fields[9].data = stripByteCounts.data();
+    fields[9].dataBytes = numStrips * sizeof(uint32_t);
+    fields[11].data = software;
+    fields[11].dataBytes = sizeof(software);
+
+    size_t entriesBytes = sizeof(uint16_t) + numFields * 12 + sizeof(uint32_t);
+    directory.assign(entriesBytes, 0);
+    memcpy(directory.data(), &numFields, sizeof(numFields));
+
+    for (uint16_t i=0; i<numFields; i++) {
+        TiffField &field = fields[i];
+        if (field.data && field.dataBytes <= 4) {
+            memcpy(&field.value, field.data, field.dataBytes);
+        } else if (field.data) {
+            field.value = directoryOffset + directory.size();
+            directory.insert(directory.end(), (const uint8_t*)field.data, (const uint8_t*)field.data + field.dataBytes);
+            if (directory.size() & 1) {
+                directory.push_back(0);
+            }
+        }
+        uint8_t *entry = directory.data() + sizeof(uint16_t) + i * 12;
+        memcpy(entry, &field.tag, 2);
+        memcpy(entry + 2, &field.type, 2);
+        memcpy(entry + 4, &field.count, 4);
+        memcpy(entry + 8, &field.value, 4);
+    }
+    // The next-directory offset after the entries stays 0: there's only the one image
+}
+
+/**
+ * The capture state of a frame as "key=value" pairs, for formats that carry a free-form description
+ * @param snapshot
+ * @param description
+ * @param length
+ */
+void FormatFrameDescription(const SEMFrameSnapshot &snapshot, char *description, size_t length) {
+    snprintf(description, length,
+             "scanMode=%d rowTime=%f syncMin=%f syncMax=%f syncAverage=%f syncNum=%u min=%d max=%d "
+             "frameNumber=%u sequence=%d file=%d stackedFrames=%u driftX=%.3f driftY=%.3f timestampNs=%" PRId64,
+             snapshot.scanMode, snapshot.frameDuration, snapshot.minSync, snapshot.maxSync, snapshot.syncAverage,
+             snapshot.syncNum, snapshot.min, snapshot.max, snapshot.frameNumber, snapshot.sequenceNumber,
+             snapshot.fileNumber, snapshot.stackedFrames, snapshot.driftX,
+             snapshot.driftY, snapshot.timestampNanoseconds);
+}
@@ -0,0 +1,38 @@
+#ifndef S2500_IMAGE_VIEWER_TIFFWRITER_H
+#define S2500_IMAGE_VIEWER_TIFFWRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/uio.h>
+#include "sem_frame_snapshot.h"
+
+#define TIFF_WRITER_ROWS_PER_STRIP 64
+
+class ThreadPool;
+
+/**
+ * Encodes frames as 16-bit grayscale, deflate-compressed TIFFs. The frame is cut into strips of
+ * TIFF_WRITER_ROWS_PER_STRIP rows that are compressed in parallel on a thread pool, and the file comes back as a list
+ * of buffers ready for a single writev(). The capture state goes in the ImageDescription tag.
+ */
+class TiffWriter {
+    private:
+        uint8_t fileHeader[8];
+        std::vector<uint8_t> directory;                  // IFD plus the values that don't fit in it
+        std::vector<std::vector<uint8_t>> strips;        // compressed strips, reused from frame to frame
+        std::vector<size_t> stripBytes;
+        std::vector<std::vector<uint16_t>> differenced;  // predictor output, per strip
+
+        bool compressStrip(const SEMFrameSnapshot &snapshot, uint32_t strip, bool predictor, int level);
+        void buildDirectory(const SEMFrameSnapshot &snapshot, uint32_t numStrips, uint32_t directoryOffset,
+                            bool predictor);
+
+    public:
+        bool encode(const SEMFrameSnapshot &snapshot, bool predictor, int level, ThreadPool &pool,
+                    std::vector<struct iovec> &iov);
+};
+
+void FormatFrameDescription(const SEMFrameSnapshot &snapshot, char *description, size_t length);
+
+#endif //S2500_IMAGE_VIEWER_TIFFWRITER_H
@@ -0,0 +1,191 @@
+#include "TiledTexture.h"
+#include <algorithm>
+#include <cstring>
+
+/**
+ * Sizes the grid for a width x height frame, dropping any tiles from before. No textures are created yet.
+ */
+void TiledTexture::allocate(int width, int height) {
+    destroy();
+    this->width = width;
+    this->height = height;
+    columns = (width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    rows = (height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    tiles.assign(columns * rows, Tile());
+    pyramid.allocate(width, height);
+}
+
+void TiledTexture::destroy() {
+    for (Tile &tile : tiles) {
+        if (tile.texture) {
+            glDeleteTextures(1, &tile.texture);
+        }
+    }
+    tiles.clear();
+    width = 0;
+    height = 0;
+    columns = 0;
+    rows = 0;
+}
+
+/**
+ * Sends rows firstRow to firstRow + numRows - 1 of the frame, and the rows of the mip levels under them, to the tiles
+ * they cross, creating any of those tiles that don't exist yet.
+ * @param pixels The whole frame
+ * @param firstRow
+ * @param numRows
+ * @param pbo The pixel unpack buffer bound by the caller, or 0 to upload from client memory
+ * @param mapped pbo, persistently mapped. The rows are staged in it where they are in the pyramid, from slotOffset on
+ * @param slotOffset
+ */
+void TiledTexture::upload(const uint16_t *pixels, int firstRow, int numRows, GLuint pbo, uint8_t *mapped,
+                          size_t slotOffset) {
+    int firstTileRow = firstRow / TEXTURE_TILE_SIZE;
+    int lastTileRow = std::min(rows - 1, (firstRow + numRows - 1) / TEXTURE_TILE_SIZE);
+    bool unbound = false;
+    uintptr_t base;
+
+    if (numRows <= 0) {
+        return;
+    }
+    uploads++;
+    pyramid.update(pixels, firstRow, numRows);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+
+    // New tiles get all of their rows at once, from client memory
+    for (int row=firstTileRow; row<=lastTileRow; row++) {
+        for (int column=0; column<columns; column++) {
+            if (tiles[row * columns + column].texture) {
+                continue;
+            }
+            if (pbo && !unbound) {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                unbound = true;
+            }
+            createTile(column, row);
+        }
+    }
+    if (unbound) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    }
+
+    for (int i=0; i<pyramid.getLevelCount(); i++) {
+        const MipLevel &level = pyramid.getLevel(i);
+        size_t start = (size_t)level.firstRow * level.width;
+        int levelRows = level.endRow - level.firstRow;
+        if (levelRows <= 0) {
+            continue;
+        }
+        if (mapped) {
+            base = slotOffset + level.offset * sizeof(uint16_t);
+            memcpy(mapped + base + start * sizeof(uint16_t), level.pixels + start,
+                   levelRows * level.width * sizeof(uint16_t));
+        } else {
+            base = (uintptr_t)level.pixels;
+        }
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, level.width);
+        for (int row=firstTileRow; row<=lastTileRow; row++) {
+            int tileTop = (row * TEXTURE_TILE_SIZE) >> i;
+            int tileBottom = tileTop + (std::min(TEXTURE_TILE_SIZE, height - row * TEXTURE_TILE_SIZE) >> i);
+            int top = std::max(level.firstRow, tileTop);
+            int bottom = std::min(level.endRow, tileBottom);
+            if (top >= bottom) {
+                continue;
+            }
+            for (int column=0; column<columns; column++) {
+                Tile &tile = tiles[row * columns + column];
+                int left = (column * TEXTURE_TILE_SIZE) >> i;
+                int tileWidth = std::min(TEXTURE_TILE_SIZE, width - column * TEXTURE_TILE_SIZE) >> i;
+                if (i >= tile.levels || tile.created == uploads) {
+                    continue;
+                }
+                glBindTexture(GL_TEXTURE_2D, tile.texture);
+                glTexSubImage2D(GL_TEXTURE_2D, i, 0, top - tileTop, tileWidth, bottom - top, GL_RED, GL_UNSIGNED_SHORT,
+                                (void*)(base + ((size_t)top * level.width + left) * sizeof(uint16_t)));
+            }
+        }
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+/**
+ * Creates the tile's texture and fills in every level from the pyramid. Sources client memory, so no pixel unpack
+ * buffer may be bound. A tile has the frame's levels down to where its shorter side would be less than a pixel.
+ */
+void TiledTexture::createTile(int column, int row) {
+    Tile &tile = tiles[row * columns + column];
+    int x = column * TEXTURE_TILE_SIZE;
+    int y = row * TEXTURE_TILE_SIZE;
+    int tileWidth = std::min(TEXTURE_TILE_SIZE, width - x);
+    int tileHeight = std::min(TEXTURE_TILE_SIZE, height - y);
+    // Single channel of raw ADC samples; the swizzle expands it to gray and LiveImageShader applies the contrast
+    const GLint swizzle[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+
+    tile.levels = 0;
+    while (tile.levels < pyramid.getLevelCount() && (tileWidth >> tile.levels) && (tileHeight >> tile.levels)) {
+        tile.levels++;
+    }
+    tile.created = uploads;
+
+    glGenTextures(1, &tile.texture);
+    glBindTexture(GL_TEXTURE_2D, tile.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tile.levels - 1);
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    for (int i=0; i<tile.levels; i++) {
+        const MipLevel &level = pyramid.getLevel(i);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, level.width);
+        glTexImage2D(GL_TEXTURE_2D, i, GL_R16, tileWidth >> i, tileHeight >> i, 0, GL_RED, GL_UNSIGNED_SHORT,
+                     level.pixels + (size_t)(y >> i) * level.width + (x >> i));
+    }
+}
+
+/**
+ * @param filter GL_TEXTURE_MAG_FILTER for every tile
+ */
+void TiledTexture::setMagFilter(GLint filter) {
+    if (filter == magFilter) {
+        return;
+    }
+    magFilter = filter;
+    for (Tile &tile : tiles) {
+        if (tile.texture) {
+            glBindTexture(GL_TEXTURE_2D, tile.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+        }
+    }
+}
+
+/**
+ * @return The tile's texture, or 0 if nothing has been uploaded to it yet
+ */
+GLuint TiledTexture::getTile(int column, int row) {
+    return tiles[row * columns + column].texture;
+}
+
+int TiledTexture::getWidth() {
+    return width;
+}
+
+int TiledTexture::getHeight() {
+    return height;
+}
+
+int TiledTexture::getColumns() {
+    return columns;
+}
+
+int TiledTexture::getRows() {
+    return rows;
+}
+
+/**
+ * @return Samples in the frame and all its mip levels: what a staging buffer for upload() has to hold
+ */
+size_t TiledTexture::getSamples() {
+    return pyramid.getSamples();
+}
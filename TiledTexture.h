@@ -0,0 +1,52 @@
+#ifndef S2500_IMAGE_VIEWER_TILEDTEXTURE_H
+#define S2500_IMAGE_VIEWER_TILEDTEXTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include "MipPyramid.h"
+
+#define TEXTURE_TILE_SIZE 512   // a power of two, so every mip level of a tile lines up with the frame's
+
+/**
+ * A frame as a grid of TEXTURE_TILE_SIZE square R16 textures, so a frame can be larger than GL_MAX_TEXTURE_SIZE and
+ * rows are only sent to the tiles they cross. A tile's texture is created the first time rows under it are uploaded;
+ * until then it's simply not drawn.
+ *
+ * The mip levels come from one MipPyramid for the whole frame: each tile's level n is its own square of the frame's
+ * level n, uploaded with GL_UNPACK_ROW_LENGTH, so the tiles filter exactly as one big texture would.
+ */
+class TiledTexture {
+    private:
+        struct Tile {
+            GLuint texture = 0;
+            int levels = 0;
+            uint32_t created = 0;           // the upload() that created it
+        };
+
+        std::vector<Tile> tiles;            // row by row
+        MipPyramid pyramid;
+        int width = 0;
+        int height = 0;
+        int columns = 0;
+        int rows = 0;
+        uint32_t uploads = 0;
+        GLint magFilter = GL_LINEAR;
+
+        void createTile(int column, int row);
+
+    public:
+        void allocate(int width, int height);
+        void destroy();
+        void upload(const uint16_t *pixels, int firstRow, int numRows, GLuint pbo, uint8_t *mapped, size_t slotOffset);
+        void setMagFilter(GLint filter);
+        GLuint getTile(int column, int row);
+        int getWidth();
+        int getHeight();
+        int getColumns();
+        int getRows();
+        size_t getSamples();
+};
+
+#endif //S2500_IMAGE_VIEWER_TILEDTEXTURE_H
@@ -0,0 +1,191 @@
+/**
+ * Headless decoder benchmark. Loads a recording (or generates a synthetic stream with the simulator) into memory,
+ * then times SEMDecoder::parse over it chunk by chunk and reports throughput and per-chunk latency percentiles.
+ *
+ *     decode_bench [--file path] [--frames n] [--size WxH] [--chunk-bytes n] [--repeat n] [--kernels name]
+ *
+ * Without --file a synthetic stream of --frames frames (default 2) at --size (default 4096x4096) is used.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "SEMDecoder.h"
+#include "SampleRing.h"
+#include "FileReplaySource.h"
+#include "SimulatedSource.h"
+#include "DecodeKernels.h"
+#include "Logger.h"
+
+struct BenchOptions {
+    const char *file = nullptr;
+    uint32_t frames = 2;
+    uint16_t width = 4096;
+    uint16_t height = 4096;
+    size_t chunkBytes = SAMPLE_RING_CHUNK_BYTES;
+    uint32_t repeat = 3;
+    const char *kernels = nullptr;
+};
+
+static void Usage(const char *name) {
+    fprintf(stderr, "usage: %s [--file path] [--frames n] [--size WxH] [--chunk-bytes n] [--repeat n] "
+                    "[--kernels scalar|SSE2|AVX2]\n", name);
+    exit(1);
+}
+
+static bool ParseOptions(int argc, char *argv[], BenchOptions &options) {
+    unsigned int width;
+    unsigned int height;
+
+    for (int i=1; i<argc; i++) {
+        if (i + 1 >= argc) {
+            return false;
+        }
+        if (strcmp(argv[i], "--file") == 0) {
+            options.file = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            options.frames = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--size") == 0) {
+            if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+                return false;
+            }
+            options.width = width;
+            options.height = height;
+        } else if (strcmp(argv[i], "--chunk-bytes") == 0) {
+            options.chunkBytes = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            options.repeat = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--kernels") == 0) {
+            options.kernels = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return options.chunkBytes > 0 && options.repeat > 0;
+}
+
+static bool LoadRecording(const char *path, std::vector<uint16_t> &stream) {
+    FileReplaySource replay(path);
+    const uint16_t *data;
+    ssize_t bytes;
+
+    if (!replay.open()) {
+        return false;
+    }
+    replay.mode = REPLAY_AS_FAST_AS_POSSIBLE;
+    while ((bytes = replay.next(&data)) > 0) {
+        stream.insert(stream.end(), data, data + bytes / sizeof(uint16_t));
+    }
+    return true;
+}
+
+static void GenerateStream(const BenchOptions &options, std::vector<uint16_t> &stream) {
+    SimulatedSourceConfig config;
+    SampleChunk *chunk = new SampleChunk();
+    size_t wanted = (size_t)options.width * options.height * options.frames;
+    ssize_t bytes;
+
+    config.width = options.width;
+    config.height = options.height;
+    config.samplesPerSecond = 0;
+    SimulatedSource simulator(config);
+    simulator.open();
+    // One extra row so the last frame is closed by a frame sync
+    while (stream.size() < wanted + options.width) {
+        bytes = simulator.read(chunk);
+        stream.insert(stream.end(), chunk->storage, chunk->storage + bytes / sizeof(uint16_t));
+    }
+    delete chunk;
+}
+
+static double Percentile(const std::vector<double> &sorted, double p) {
+    size_t i = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    std::vector<uint16_t> stream;
+    std::vector<double> chunkMicroseconds;
+
+    if (!ParseOptions(argc, argv, options)) {
+        Usage(argv[0]);
+    }
+
+    if (options.file) {
+        if (!LoadRecording(options.file, stream)) {
+            fprintf(stderr, "Unable to load %s\n", options.file);
+            Logger::Instance()->quit();
+            return 1;
+        }
+    } else {
+        GenerateStream(options, stream);
+    }
+    if (stream.empty()) {
+        fprintf(stderr, "Nothing to decode\n");
+        Logger::Instance()->quit();
+        return 1;
+    }
+
+    SEMCapture capture;
+    SEMCapturePixels pixels;
+    capture.sourceWidth = options.width;
+    capture.sourceHeight = options.height;
+    pixels.allocate(capture.sourceWidth, capture.sourceHeight);
+
+    SEMDecoder decoder(&capture, &pixels, nullptr);
+    if (options.kernels) {
+        const DecodeKernels *kernels = FindDecodeKernels(options.kernels);
+        if (!kernels) {
+            fprintf(stderr, "Kernels %s aren't available on this CPU\n", options.kernels);
+            Logger::Instance()->quit();
+            return 1;
+        }
+        decoder.setKernels(kernels);
+    }
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(stream.data());
+    size_t streamBytes = stream.size() * sizeof(uint16_t);
+    size_t chunkBytes;
+    chunkMicroseconds.reserve((streamBytes / options.chunkBytes + 1) * options.repeat);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t r=0; r<options.repeat; r++) {
+        for (size_t offset=0; offset<streamBytes; offset+=chunkBytes) {
+            chunkBytes = std::min(options.chunkBytes, streamBytes - offset);
+            auto chunkStart = std::chrono::steady_clock::now();
+            decoder.parse(reinterpret_cast<const uint16_t *>(bytes + offset), chunkBytes);
+            auto chunkStop = std::chrono::steady_clock::now();
+            chunkMicroseconds.push_back(std::chrono::duration<double, std::micro>(chunkStop - chunkStart).count());
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Flush the decoder's messages, and what was dropped of them, ahead of the results
+    Logger::Instance()->quit();
+
+    std::sort(chunkMicroseconds.begin(), chunkMicroseconds.end());
+    double totalBytes = (double)streamBytes * options.repeat;
+
+    printf("\n");
+    printf("input:        %s, %f MB x %u passes\n", options.file ? options.file : "synthetic", streamBytes/1e6, options.repeat);
+    const SEMFrameSnapshot *published = pixels.frames.pinPublished();
+    if (published) {
+        printf("frame:        %dx%d\n", published->width, published->height);
+        pixels.frames.unpin(published);
+    } else {
+        printf("frame:        none complete\n");
+    }
+    printf("chunk:        %zu bytes\n", options.chunkBytes);
+    printf("elapsed:      %f s\n", seconds);
+    printf("throughput:   %.1f MB/s\n", totalBytes / seconds / 1e6);
+    printf("samples/s:    %.1f M\n", totalBytes / sizeof(uint16_t) / seconds / 1e6);
+    printf("rows/s:       %.0f\n", capture.syncNum / seconds);
+    printf("frames/s:     %.2f\n", pixels.frameNumber.load() / seconds);
+    printf("chunk (µs):   p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           Percentile(chunkMicroseconds, 50), Percentile(chunkMicroseconds, 90), Percentile(chunkMicroseconds, 99),
+           Percentile(chunkMicroseconds, 99.9), chunkMicroseconds.back());
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef S2500_IMAGE_VIEWER_LATENCY_HISTOGRAM_H
+#define S2500_IMAGE_VIEWER_LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+#define LATENCY_SUB_BUCKET_BITS     4   // 16 buckets per power of two: values are kept to within 1/16
+#define LATENCY_SUB_BUCKETS         (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_EXPONENT        40  // about 18 minutes in nanoseconds; anything longer lands in the last bucket
+#define LATENCY_BUCKETS             ((LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS + 2) * LATENCY_SUB_BUCKETS)
+
+/**
+ * Counts of durations in log-linear buckets, HDR histogram style: exact below LATENCY_SUB_BUCKETS ns, then
+ * LATENCY_SUB_BUCKETS buckets between each power of two and the next, so every recorded value is known to within
+ * about 6% whatever its size. Recording is a couple of shifts and a relaxed increment, cheap enough for every chunk
+ * on the decode thread. Readers copy the counts out with snapshot() and work from the copy.
+ */
+struct LatencyHistogram {
+    std::atomic<uint64_t> counts[LATENCY_BUCKETS];
+
+    LatencyHistogram() {
+        reset();
+    }
+
+    static uint32_t BucketOf(uint64_t nanoseconds) {
+        if (nanoseconds < LATENCY_SUB_BUCKETS) {
+            return (uint32_t)nanoseconds;
+        }
+        uint32_t exponent = 63 - __builtin_clzll(nanoseconds);
+        if (exponent > LATENCY_MAX_EXPONENT) {
+            return LATENCY_BUCKETS - 1;
+        }
+        uint32_t sub = (uint32_t)(nanoseconds >> (exponent - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+        return (exponent - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+    }
+
+    // Middle of the range of values that land in bucket
+    static double ValueOf(uint32_t bucket) {
+        if (bucket < LATENCY_SUB_BUCKETS) {
+            return bucket;
+        }
+        uint32_t exponent = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKET_BITS - 1;
+        uint64_t width = 1ull << (exponent - LATENCY_SUB_BUCKET_BITS);
+        uint64_t low = (1ull << exponent) + (bucket % LATENCY_SUB_BUCKETS) * width;
+        return low + width / 2.0;
+    }
+
+    void record(uint64_t nanoseconds) {
+        counts[BucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void snapshot(uint64_t *out) const {
+        for (uint32_t i=0; i<LATENCY_BUCKETS; i++) {
+            out[i] = counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    void reset() {
+        for (uint32_t i=0; i<LATENCY_BUCKETS; i++) {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @param buckets Counts from snapshot(), or the difference of two
+     * @param fraction 0.5 for the median, 0.99 for the 99th percentile, 1 for the largest
+     * @return The duration in nanoseconds, or 0 if nothing was recorded
+     */
+    static double Percentile(const uint64_t *buckets, double fraction) {
+        uint64_t total = 0;
+        uint64_t seen = 0;
+        uint64_t rank;
+
+        for (uint32_t i=0; i<LATENCY_BUCKETS; i++) {
+            total += buckets[i];
+        }
+        if (!total) {
+            return 0;
+        }
+        rank = (uint64_t)(fraction * total + 0.5);
+        rank = rank < 1 ? 1 : rank > total ? total : rank;
+        for (uint32_t i=0; i<LATENCY_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return ValueOf(i);
+            }
+        }
+        return 0;
+    }
+};
+
+#endif //S2500_IMAGE_VIEWER_LATENCY_HISTOGRAM_H
@@ -0,0 +1,83 @@
+#ifndef S2500_IMAGE_VIEWER_LOG_RECORD_H
+#define S2500_IMAGE_VIEWER_LOG_RECORD_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define LOG_MAX_ARGS        8
+#define LOG_STRING_BYTES    160 // room for copies of string arguments
+
+enum LogArgType : uint8_t {
+    LOG_ARG_SIGNED,
+    LOG_ARG_UNSIGNED,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,     // value.offset into strings
+    LOG_ARG_POINTER,
+};
+
+/**
+ * A log message as the caller left it: the format string, which must be a literal, and its arguments, unformatted.
+ * String arguments are copied, since the caller's buffer won't outlive the call. One slot of the Logger's ring.
+ */
+struct LogRecord {
+    std::atomic<size_t> sequence{0};    // ring bookkeeping, see Logger
+    const char *format = nullptr;
+    int64_t timestampNanoseconds = 0;   // wall clock
+    uint8_t argCount = 0;
+    uint8_t stringBytes = 0;
+    LogArgType types[LOG_MAX_ARGS];
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const void *p;
+        uint32_t offset;
+    } args[LOG_MAX_ARGS];
+    char strings[LOG_STRING_BYTES];
+
+    void add(LogArgType type, int64_t i) {
+        if (argCount < LOG_MAX_ARGS) {
+            types[argCount] = type;
+            args[argCount++].i = i;
+        }
+    }
+
+    void add(double d) {
+        if (argCount < LOG_MAX_ARGS) {
+            types[argCount] = LOG_ARG_DOUBLE;
+            args[argCount++].d = d;
+        }
+    }
+
+    void add(const void *p) {
+        if (argCount < LOG_MAX_ARGS) {
+            types[argCount] = LOG_ARG_POINTER;
+            args[argCount++].p = p;
+        }
+    }
+
+    // Copies as much of s as still fits
+    void addString(const char *s) {
+        uint32_t offset = stringBytes;
+
+        if (argCount >= LOG_MAX_ARGS) {
+            return;
+        }
+        if (!s) {
+            s = "(null)";
+        }
+        while (*s && stringBytes < LOG_STRING_BYTES - 1) {
+            strings[stringBytes++] = *s++;
+        }
+        if (stringBytes < LOG_STRING_BYTES) {
+            strings[stringBytes++] = '\0';
+        } else {
+            strings[LOG_STRING_BYTES - 1] = '\0';
+        }
+        types[argCount] = LOG_ARG_STRING;
+        args[argCount++].offset = offset < LOG_STRING_BYTES ? offset : LOG_STRING_BYTES - 1;
+    }
+};
+
+#endif //S2500_IMAGE_VIEWER_LOG_RECORD_H
@@ -1,25 +1,47 @@
 #include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <glad/glad.h>
 #include <SDL.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <errno.h>
 #include "imgui/imgui_impl_sdl.h"
 #include "imgui/imgui_impl_opengl3.h"
 #include "sem_capture_info.h"
 #include "sem_capture_pixels.h"
-#include <termios.h>
 #include <thread>
 #include <mutex>
 #include "Logger.h"
 #include "SequenceWriter.h"
-
-#define MAX_ADC_VAL 8192
-
-// Data source 0 should always be cached data and will be opened in read-only mode.
-// The others should be devices and will be opened in RW mode
-const char *ttySources[] = { "../data.dat", "/dev/ttyACM0", "/dev/ttyACM1", "/dev/ttyACM2", "/dev/ttyACM3", "/dev/ttyACM4" };
-static int currentTtySource = 0;
+#include "SampleRing.h"
+#include "SEMDecoder.h"
+#include "LiveImageShader.h"
+#include "ImageViewport.h"
+#include "TiledTexture.h"
+#include "TextureStreamer.h"
+#include "CaptureSource.h"
+#include "SerialSource.h"
+#include "FileReplaySource.h"
+#include "SimulatedSource.h"
+#include "FrameStacker.h"
+#include "LogViewer.h"
+#include "PerfMonitor.h"
+#include "PerformancePanel.h"
+
+// Data source 0 should always be cached data and will be replayed from a read-only mapping.
+// Data source 1 is the built-in simulator. The others should be devices and will be opened in RW mode
+#define CAPTURE_SOURCE_RECORDING    0
+#define CAPTURE_SOURCE_SIMULATOR    1
+const char *captureSources[] = { "../data.dat", "Simulator", "/dev/ttyACM0", "/dev/ttyACM1", "/dev/ttyACM2", "/dev/ttyACM3", "/dev/ttyACM4" };
+static int currentCaptureSource = 0;
+const char *replayModes[] = { "As fast as possible", "Real time", "Single step" };
+static int currentReplayMode = REPLAY_REAL_TIME;
+const char *frameFormats[] = { "16-bit raw (.s2r)", "8-bit PPM", "16-bit TIFF, deflate",
+                               "16-bit TIFF, deflate + predictor", "16-bit PNG" };
+const char *backpressurePolicies[] = { "Drop oldest", "Block", "Spill to disk" };
+const char *windowModes[] = { "Percentiles", "Min/max", "Manual" };
+const char *colourMaps[] = { "Gray", "Inverted", "Hot", "Rainbow", "Gray, clipping in colour" };
+SimulatedSourceConfig simulatorConfig;
 
 #define COMMAND_SCAN_RESTART        0xA0
 #define COMMAND_SCAN_RAPID          0xA1
@@ -34,56 +56,92 @@ int windowWidth = 1140;
 int windowHeight = 1265;
 
 SequenceWriter *writer = nullptr;
+SEMDecoder *decoder = nullptr;
+FrameStacker *stacker = nullptr;
+TiledTexture liveTexture;
+TiledTexture stackTexture;
+uint16_t stackPreviewMin = 0;
+uint16_t stackPreviewMax = 0;
+uint32_t stackPreviewVersion = 0;
+bool showStackPreview = false;
+bool showScanProgress = true;       // rows as they're scanned, rather than only complete frames
+enum DisplayWindowMode {
+    WINDOW_PERCENTILES,             // from windowLowPercent to windowHighPercent of the histogram
+    WINDOW_MIN_MAX,
+    WINDOW_MANUAL,                  // windowBlack to windowWhite
+};
+int windowMode = WINDOW_PERCENTILES;
+float windowLowPercent = 0.1f;
+float windowHighPercent = 99.9f;
+int windowBlack = 0;
+int windowWhite = MAX_ADC_VAL - 1;
+uint32_t liveHistogram[SAMPLE_HISTOGRAM_BINS + 1];
+uint64_t liveHistogramSamples = 0;
+uint32_t liveHistogramVersion = 0;
+uint32_t stackHistogram[SAMPLE_HISTOGRAM_BINS + 1];
+uint64_t stackHistogramSamples = 0;
+uint32_t framesRequested = 0;       // "Save next frame" clicks that were taken
+const int driftHistoryLength = 128;
+float driftHistoryX[driftHistoryLength];    // drift of recent stacked frames, oldest first from driftHistoryNext
+float driftHistoryY[driftHistoryLength];
+int driftHistoryNext = 0;
+LiveImageShader liveImageShader;
+ImageViewport liveViewport;
+TextureStreamer textureStreamer;
+LogViewer logViewer(Logger::Instance()->getHistory());
+PerformancePanel performancePanel(*PerfMonitor::Instance());
+bool performanceWindowOpen = false;
 
 void SetGLAttributes();
-void setupTexture(GLuint *glTexture, uint8_t *pixels, SEMCapture *capture);
+void UploadStackPreview();
+void SetDisplayWindow(uint16_t min, uint16_t max, const uint32_t *histogram, uint64_t histogramSamples);
+void PlotSampleHistogram(const uint32_t *histogram);
+void SamplePerformance(SEMCapture &capture, SEMCapturePixels &capturePixels);
 void HandleEvent(SDL_Event *event, bool *shouldQuit);
-void Quit(SDL_Window *window, SDL_GLContext &glContext, uint8_t *pixels);
+void Quit(SDL_Window *window, SDL_GLContext &glContext);
 void CreateWindow(SDL_WindowFlags &windowFlags, SDL_Window *&window, SDL_GLContext &glContext);
-bool InitSEMCapture(SEMCapture *ci, const char *dataFilePath, struct termios *termios);
+CaptureSource *CreateCaptureSource(int sourceIndex);
+bool InitSEMCapture(SEMCapture *ci, int sourceIndex);
 void DeleteSEMCapture(SEMCapture *ci);
-void ParseSEMCaptureData(SEMCapture *ci, SEMCapturePixels *p, ssize_t bytesRead);
-void ParseStatusBytes(SEMCapture *ci, SEMCapturePixels *p, uint16_t &i);
 void SendCommand(uint8_t command, const SEMCapture &capture);
-void ImGuiFrame(uint32_t &statusTimer, SEMCapture &capture, SEMCapturePixels &capturePixels, termios &termios, GLuint glTexture,
-    std::thread &captureThread, std::mutex &bufferLock, ssize_t &bytesRead, bool &logWindowOpen);
-void SetupGLAndImgui(SDL_Window *window, SDL_GLContext glContext, SEMCapturePixels &capturePixels, SEMCapture &capture,
-                     GLuint &glTexture);
-void GrabBytes(ssize_t &bytesRead, SEMCapture &ci, std::mutex &bufferLock);
+void ImGuiFrame(uint32_t &statusTimer, SEMCapture &capture, SEMCapturePixels &capturePixels,
+    std::thread &captureThread, bool &logWindowOpen);
+void SetupGLAndImgui(SDL_Window *window, SDL_GLContext glContext, SEMCapturePixels &capturePixels);
+void GrabBytes(SEMCapture &ci);
 
 int main(int argc, char *argv[]) {
     SDL_Window *window = NULL;
     SDL_WindowFlags windowFlags;
     SDL_GLContext glContext;
-    GLuint glTexture;
-    ssize_t bytesRead = 0;      // reset every time the buffer is read
-    uint32_t totalBytesRead = 0; // total
     uint32_t statusTimer = 0;
-    std::mutex bufferLock;
     bool logWindowOpen = false;
     int currentSequenceNumber = 0;
 
     SEMCapture capture;
-    struct termios termios;
 
     Logger::Instance()->init();
     Logger::Instance()->log("Starting up");
 
-    if (!InitSEMCapture(&capture, ttySources[currentTtySource], &termios)) {
+    if (!InitSEMCapture(&capture, currentCaptureSource)) {
         Logger::Instance()->log("Unable to init the SEM capture.");
     }
     capture.shouldCapture = true;
-    std::thread captureThread(GrabBytes, std::ref(bytesRead), std::ref(capture), std::ref(bufferLock));
+    std::thread captureThread(GrabBytes, std::ref(capture));
 
     SEMCapturePixels capturePixels;
-    capturePixels.pixels = (uint8_t*)malloc((capture.sourceWidth * capture.sourceHeight * 4));
-    memset(capturePixels.pixels, 0x00, capture.sourceWidth * capture.sourceHeight * 4);
+    capturePixels.allocate(capture.sourceWidth, capture.sourceHeight);
 
     writer = new SequenceWriter(currentSequenceNumber);
+    writer->start();
+    stacker = new FrameStacker(writer);
+    stacker->start();
+    decoder = new SEMDecoder(&capture, &capturePixels, writer);
+    decoder->setStacker(stacker);
+    decoder->start();
 
     SetGLAttributes();
     CreateWindow(windowFlags, window, glContext);
-    SetupGLAndImgui(window, glContext, capturePixels, capture, glTexture);
+    SetupGLAndImgui(window, glContext, capturePixels);
 
     bool shouldQuit = false;
     while (!shouldQuit) {
@@ -93,39 +151,34 @@ int main(int argc, char *argv[]) {
             HandleEvent(&event, &shouldQuit);
         }
 
-        if (!capture.bufferReadyForWrite && bufferLock.try_lock()) {
-            if (bytesRead <= 0) {
-                capture.status = CaptureStatus::STATUS_PAUSED;
-//                Logger::Instance()->log("End of data or error. Status: %d. Total read: %d. Errno: %d", bytesRead, totalBytesRead, errno);
-            } else {
-                capture.status = CaptureStatus::STATUS_RUNNING;
-                capture.bytesRead += bytesRead;
-            }
-
-            if (capture.status == CaptureStatus::STATUS_RUNNING) {
-                ParseSEMCaptureData(&capture, &capturePixels, bytesRead);
-            }
-            capture.bufferReadyForWrite = true;
-            bufferLock.unlock();
-        }
-
-        // TODO: render only a region
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, capture.sourceWidth, capture.sourceHeight, GL_RGBA, GL_UNSIGNED_BYTE, capturePixels.pixels);
+        int64_t uploadStart = PerfMonitor::Now();
+        textureStreamer.upload(capturePixels.frames, showScanProgress);
+        PerfMonitor::Instance()->recordSince(PERF_UPLOAD, uploadStart);
+        UploadStackPreview();
+        SamplePerformance(capture, capturePixels);
 
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplSDL2_NewFrame(window);
-        ImGuiFrame(statusTimer, capture, capturePixels, termios, glTexture, captureThread, bufferLock, bytesRead, logWindowOpen);
+        ImGuiFrame(statusTimer, capture, capturePixels, captureThread, logWindowOpen);
 
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        int64_t presentStart = PerfMonitor::Now();
         SDL_GL_SwapWindow(window);
+        PerfMonitor::Instance()->recordSince(PERF_PRESENT, presentStart);
+        PerfMonitor::Instance()->count(PERF_UI_FRAMES);
     }
 
     capture.shouldCapture = false;
-    capture.bufferReadyForWrite = false;
     captureThread.join();
+    decoder->stop();
+    delete decoder;
+    stacker->stop();
+    delete stacker;
+    writer->stop();
+    delete writer;
     DeleteSEMCapture(&capture);
-    Quit(window, glContext, capturePixels.pixels);
+    Quit(window, glContext);
 
     Logger::Instance()->log("Shutting down");
     Logger::Instance()->quit();
@@ -133,8 +186,7 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
-void SetupGLAndImgui(SDL_Window *window, SDL_GLContext glContext, SEMCapturePixels &capturePixels, SEMCapture &capture,
-                     GLuint &glTexture) {
+void SetupGLAndImgui(SDL_Window *window, SDL_GLContext glContext, SEMCapturePixels &capturePixels) {
     if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
         Logger::Instance()->log("[ERROR] Couldn't initialize glad");
     } else {
@@ -142,7 +194,14 @@ void SetupGLAndImgui(SDL_Window *window, SDL_GLContext glContext, SEMCapturePixe
     }
 
     glViewport(0, 0, windowWidth, windowHeight);
-    setupTexture(&glTexture, capturePixels.pixels, &capture);
+    // Tiles appear as the decoder's rows come in, including any it has already scanned. The decoder is already
+    // running and owns the frame size, so take it from the frame it's scanning
+    const SEMFrameSnapshot *live = capturePixels.frames.pinLive();
+    if (live) {
+        liveTexture.allocate(live->width, live->height);
+        capturePixels.frames.unpin(live);
+    }
+    textureStreamer.init(&liveTexture);
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImGuiIO &io = ImGui::GetIO();
@@ -154,8 +213,8 @@ void SetupGLAndImgui(SDL_Window *window, SDL_GLContext glContext, SEMCapturePixe
     glClearColor(background.x, background.y, background.z, background.w);
 }
 
-void ImGuiFrame(uint32_t &statusTimer, SEMCapture &capture, SEMCapturePixels &capturePixels, termios &termios, GLuint glTexture,
-    std::thread &captureThread, std::mutex &bufferLock, ssize_t &bytesRead, bool &logWindowOpen) {
+void ImGuiFrame(uint32_t &statusTimer, SEMCapture &capture, SEMCapturePixels &capturePixels,
+    std::thread &captureThread, bool &logWindowOpen) {
     ImGui::NewFrame();
     {
         int sdl_width = 0;
@@ -185,9 +244,58 @@ void ImGuiFrame(uint32_t &statusTimer, SEMCapture &capture, SEMCapturePixels &ca
         ImGui::Text("Capture");
         ImGui::Dummy(ImVec2(0.0f, 4.0f));
         ImGui::Indent();
-            if (ImGui::Button("Save next frame")) { Logger::Instance()->log("Counter button clicked."); }
-            if (ImGui::Button("Begin stacked capture")) { Logger::Instance()->log("Counter button clicked."); }
-            if (ImGui::Button("End stacked capture")) { Logger::Instance()->log("Counter button clicked."); }
+            if (ImGui::Button("Save next frame") && !decoder->saveNextFrame.exchange(true)) {
+                framesRequested++;
+            }
+            if (decoder->savingFrame) {
+                ImGui::Text("Scanning the frame to save...");
+            } else if (decoder->saveNextFrame) {
+                ImGui::Text("Waiting for the next frame to start...");
+            } else if (writer->requestedFramesFinished.load() < framesRequested + stacker->stacksQueued.load()) {
+                ImGui::Text("Writing...");
+            } else if (framesRequested + stacker->stacksQueued.load() > 0) {
+                char savedFileName[256];
+                writer->getLastRequestedFileName(savedFileName, sizeof(savedFileName));
+                if (savedFileName[0]) {
+                    ImGui::Text("Saved %s", savedFileName);
+                } else {
+                    ImGui::Text("Couldn't save the frame, see the log");
+                }
+            }
+            if (ImGui::Button("Begin stacked capture")) { stacker->begin(); }
+            if (ImGui::Button("End stacked capture")) { stacker->end(); }
+            bool sigmaClip = stacker->sigmaClip.load();
+            if (ImGui::Checkbox("Sigma clipping", &sigmaClip)) {
+                stacker->sigmaClip = sigmaClip;
+            }
+            if (sigmaClip) {
+                float kappa = stacker->kappa.load();
+                if (ImGui::SliderFloat("Kappa (sigma)", &kappa, 1.5f, 5.0f, "%.1f")) {
+                    stacker->kappa = kappa;
+                }
+            }
+            bool correctDrift = stacker->correctDrift.load();
+            if (ImGui::Checkbox("Correct drift", &correctDrift)) {
+                stacker->correctDrift = correctDrift;
+            }
+            if (stacker->isStacking()) {
+                ImGui::Text("Stacking:\t%u frames", stacker->framesStacked.load());
+            } else {
+                ImGui::Text("Last stack:\t%u frames", stacker->framesStacked.load());
+            }
+            ImGui::Text("Skipped:\t%llu", (unsigned long long)stacker->framesSkipped.load());
+            ImGui::Text("Add frame:\t%.1f ms", stacker->lastAddMilliseconds.load());
+            if (correctDrift) {
+                ImGui::Text("Drift:\t%.2f, %.2f px (peak %.2f)", stacker->driftX.load(), stacker->driftY.load(),
+                            stacker->driftPeak.load());
+                ImGui::Text("Register:\t%.1f ms, %u unmatched", stacker->lastRegisterMilliseconds.load(),
+                            stacker->framesUnregistered.load());
+                ImGui::PlotLines("Drift X", driftHistoryX, driftHistoryLength, driftHistoryNext, nullptr, FLT_MAX,
+                                 FLT_MAX, ImVec2(0, 40));
+                ImGui::PlotLines("Drift Y", driftHistoryY, driftHistoryLength, driftHistoryNext, nullptr, FLT_MAX,
+                                 FLT_MAX, ImVec2(0, 40));
+            }
+            ImGui::Checkbox("Show stack in live output", &showStackPreview);
         ImGui::Unindent();
         ImGui::Dummy(ImVec2(0.0f, 4.0f));
         ImGui::End();
@@ -196,79 +304,194 @@ void ImGuiFrame(uint32_t &statusTimer, SEMCapture &capture, SEMCapturePixels &ca
             ImGui::Indent();
             ImGui::Dummy(ImVec2(0.0f, 4.0f));
             if (ImGui::Button("Heartbeat")) { SendCommand(COMMAND_HEARTBEAT, capture); }
-            if (capture.heartbeat) {
+            if (capture.heartbeat.exchange(false)) {
+                statusTimer = 60;
+            }
+            if (statusTimer > 0) {
                 ImGui::Text("System heartbeat OK!");
-                statusTimer += 1;
-                if (statusTimer >= 60) {
-                    capture.heartbeat = 0;
-                    statusTimer = 0;
-                }
+                statusTimer--;
             }
             ImGui::Dummy(ImVec2(0.0f, 4.0f));
             ImGui::Text(capture.status == STATUS_RUNNING ? "Status:\t\tRunning": "Status:\t\tNo Data");
-            ImGui::Text("Device:\t\t%s", ttySources[currentTtySource]);
-            ImGui::Combo("", &currentTtySource, ttySources, IM_ARRAYSIZE(ttySources));
+            ImGui::Text("Device:\t\t%s", capture.source ? capture.source->getName() : "None");
+            ImGui::Combo("", &currentCaptureSource, captureSources, IM_ARRAYSIZE(captureSources));
+            FileReplaySource *replay = dynamic_cast<FileReplaySource *>(capture.source);
+            if (replay) {
+                if (ImGui::Combo("Playback", &currentReplayMode, replayModes, IM_ARRAYSIZE(replayModes))) {
+                    replay->mode = (ReplayMode)currentReplayMode;
+                }
+                if (currentReplayMode == REPLAY_SINGLE_STEP && ImGui::Button("Step frame")) {
+                    replay->requestStep();
+                }
+                ImGui::Text("Replay:\t\t%f/%f MB", replay->getPositionBytes()/1e6, replay->getSizeBytes()/1e6);
+            }
+            SimulatedSource *simulator = dynamic_cast<SimulatedSource *>(capture.source);
+            if (simulator) {
+                float rate = (float)(simulator->samplesPerSecond.load() / 1e6);
+                if (ImGui::SliderFloat("MS/s (0 = unlimited)", &rate, 0.0f, 200.0f, "%.2f", ImGuiSliderFlags_Logarithmic)) {
+                    simulator->samplesPerSecond = rate * 1e6;
+                    simulatorConfig.samplesPerSecond = rate * 1e6;
+                }
+                ImGui::SliderFloat("Drift (px/frame, on restart)", &simulatorConfig.driftPixelsPerFrame, 0.0f, 8.0f);
+                int size[2] = { simulatorConfig.width, simulatorConfig.height };
+                if (ImGui::InputInt2("Size (on restart)", size)) {
+                    for (int &side : size) {
+                        side = std::min(std::max(side, GEOMETRY_MIN_SIDE), GEOMETRY_MAX_SIDE);
+                    }
+                    simulatorConfig.width = (uint16_t)size[0];
+                    simulatorConfig.height = (uint16_t)size[1];
+                }
+                int scanMode = simulatorConfig.scanMode;
+                if (ImGui::InputInt("Scan mode (on restart)", &scanMode)) {
+                    simulatorConfig.scanMode = (uint8_t)std::min(std::max(scanMode, 0), GEOMETRY_SCAN_MODES - 1);
+                }
+                ImGui::Text("Simulated:\t%f MS", simulator->samplesGenerated.load()/1e6);
+            }
 
             ImGui::Dummy(ImVec2(0.0f, 4.0f));
-            ImGui::TextColored(ImVec4(1.0f, 0.0f, 1.0f, 1.0f), "Last Row");
-            ImGui::Text("Scan mode:\t\t%d", capture.scanMode);
-            ImGui::Text("Pulse Time (s): %f", capture.syncDuration);
-            ImGui::Text("Row Time(s):\t%f", capture.frameDuration);
-            ImGui::Text("MB received:\t%f", capture.bytesRead/1e6);
-            ImGui::Text("Row overhead (µs):\t%d", capture.lastRowDurationMicroseconds);
+            ImGui::TextColored(ImVec4(1.0f, 0.0f, 1.0f, 1.0f), "Last Frame");
+            // The decoder owns the capture state; what it was for the last frame comes with the frame
+            const SEMFrameSnapshot *published = capturePixels.frames.pinPublished();
+            if (published) {
+                ImGui::Text("Scan mode:\t\t%d", published->scanMode);
+                ImGui::Text("Frame size:\t\t%dx%d", published->width, published->height);
+                ImGui::Text("Pulse Time (s): %f", published->syncDuration);
+                ImGui::Text("Row Time(s):\t%f", published->frameDuration);
+                capturePixels.frames.unpin(published);
+            }
+            ImGui::Text("MB received:\t%f", capture.bytesRead.load()/1e6);
+            ImGui::Text("Frames decoded:\t%d", capturePixels.frameNumber.load());
+            ImGui::Text("Frame buffers:\t%d (%u frames held back)", capturePixels.frames.getBufferCount(),
+                        capturePixels.frames.framesHeldBack.load());
+            ImGui::Dummy(ImVec2(0.0f, 1.0f));
+            ImGui::TextColored(ImVec4(1.0f, 0.0f, 1.0f, 1.0f), "Sample Ring");
+            ImGui::Text("Fill:\t\t%d/%d chunks", capture.ring->getFillLevel(), capture.ring->getCapacity());
+            ImGui::ProgressBar((float)capture.ring->getFillLevel() / capture.ring->getCapacity());
+            ImGui::Text("High water:\t%d chunks", capture.ring->getHighWater());
+            ImGui::Text("Overruns:\t%llu (%f MB dropped)", (unsigned long long)capture.ring->getOverruns(),
+                        capture.ring->getOverrunBytes()/1e6);
             ImGui::Dummy(ImVec2(0.0f, 1.0f));
             ImGui::Dummy(ImVec2(0.0f, 1.0f));
             ImGui::Text("FPS avg: %.2f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
                         ImGui::GetIO().Framerate);
+            ImGui::Text("Texture upload:\t%s", textureStreamer.isStreaming() ? "streamed" : "client memory");
+            ImGui::Text("Deferred uploads:\t%d", textureStreamer.deferredUploads);
+            ImGui::Checkbox("Show frames as they're scanned", &showScanProgress);
+            ImGui::Checkbox("Show performance", &performanceWindowOpen);
             ImGui::Dummy(ImVec2(0.0f, 1.0f));
         ImGui::Unindent();
         ImGui::Dummy(ImVec2(0.0f, 4.0f));
         if (ImGui::Button("Restart all")) {
-            bufferLock.lock();
             capture.shouldCapture = false;
-            capture.bufferReadyForWrite = true;
-            bufferLock.unlock();
             captureThread.join();
-            InitSEMCapture(&capture, ttySources[currentTtySource], &termios);
+            decoder->stop();
+            DeleteSEMCapture(&capture);
+            InitSEMCapture(&capture, currentCaptureSource);
             capture.shouldCapture = true;
-            captureThread = std::thread(GrabBytes, std::ref(bytesRead), std::ref(capture), std::ref(bufferLock));
+            captureThread = std::thread(GrabBytes, std::ref(capture));
+            decoder->start();
         }
         if (ImGui::Button("Reset min/max")) {
-            capturePixels.min = MAX_ADC_VAL;
-            capturePixels.max = 0;
+            decoder->resetMinMax = true;
         }
+        ImGui::Dummy(ImVec2(0.0f, 4.0f));
+        ImGui::Text("Display");
+        ImGui::Dummy(ImVec2(0.0f, 4.0f));
+        ImGui::Indent();
+            if (capturePixels.histogram.version.load() != liveHistogramVersion) {
+                liveHistogramVersion = capturePixels.histogram.version.load();
+                liveHistogramSamples = capturePixels.histogram.copy(liveHistogram);
+            }
+            PlotSampleHistogram(showStackPreview && stackTexture.getWidth() ? stackHistogram : liveHistogram);
+            ImGui::Combo("Window", &windowMode, windowModes, IM_ARRAYSIZE(windowModes));
+            if (windowMode == WINDOW_PERCENTILES) {
+                ImGui::DragFloatRange2("Percentiles", &windowLowPercent, &windowHighPercent, 0.05f, 0.0f, 100.0f,
+                                       "%.2f%%", "%.2f%%");
+            }
+            if (windowMode != WINDOW_MANUAL) {
+                windowBlack = (int)liveImageShader.black;
+                windowWhite = (int)liveImageShader.white;
+            }
+            if (ImGui::DragIntRange2("Black/white", &windowBlack, &windowWhite, 4.0f, 0, MAX_ADC_VAL - 1)) {
+                windowMode = WINDOW_MANUAL;
+            }
+            ImGui::SliderFloat("Gamma", &liveImageShader.gamma, 0.2f, 5.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+            int colourMap = liveImageShader.colourMap;
+            if (ImGui::Combo("Colour map", &colourMap, colourMaps, IM_ARRAYSIZE(colourMaps))) {
+                liveImageShader.colourMap = (ColourMap)colourMap;
+            }
+        ImGui::Unindent();
         ImGui::Checkbox("Show log window", &logWindowOpen);
         ImGui::End();
 
-        ImGui::Begin("Live output", NULL, ImGuiWindowFlags_AlwaysAutoResize);
-        ImGui::Image((void*)(intptr_t)glTexture, ImVec2(capture.sourceWidth, capture.sourceHeight));
+        ImGui::SetNextWindowSize(ImVec2(800, 800), ImGuiCond_FirstUseEver);
+        ImGui::Begin("Live output", NULL, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
+        if (showStackPreview && stackTexture.getWidth()) {
+            SetDisplayWindow(stackPreviewMin, stackPreviewMax, stackHistogram, stackHistogramSamples);
+            liveViewport.draw(stackTexture, &liveImageShader);
+        } else {
+            SetDisplayWindow(capturePixels.min, capturePixels.max, liveHistogram, liveHistogramSamples);
+            liveViewport.draw(liveTexture, &liveImageShader);
+        }
         ImGui::End();
 
         if (logWindowOpen) {
-            ImGui::Begin("Log window", &logWindowOpen);
-            ImGui::Text("Log");
-            if (ImGui::Button("Close")) {
-                logWindowOpen = false;
-            }
-            ImGui::End();
+            logViewer.draw(&logWindowOpen);
+        }
+        if (performanceWindowOpen) {
+            performancePanel.draw(&performanceWindowOpen);
         }
 
         ImGui::Begin("Save Captures");
-        ImGui::Checkbox("Save frames to disk", &writer->shouldWrite);
+        bool shouldWrite = writer->shouldWrite.load();
+        if (ImGui::Checkbox("Save frames to disk", &shouldWrite)) {
+            writer->shouldWrite = shouldWrite;
+        }
         ImGui::Text("Current File Number:\t%d", writer->getCurrentFileNum());
         ImGui::Text("Current Sequence:\t%d", writer->getCurrentSequenceNum());
         ImGui::Text("Current path:\t%s", writer->getCurrentDirectoryName());
         if (ImGui::Button("Next Sequence")) {
             writer->IncrementSequenceNumber();
         }
+        int format = writer->format.load();
+        if (ImGui::Combo("Format", &format, frameFormats, IM_ARRAYSIZE(frameFormats))) {
+            writer->format = (FrameFormat)format;
+        }
+        if (format == FRAME_FORMAT_TIFF_DEFLATE || format == FRAME_FORMAT_TIFF_DEFLATE_PREDICTOR ||
+            format == FRAME_FORMAT_PNG) {
+            int level = writer->compressionLevel.load();
+            if (ImGui::SliderInt("Compression level", &level, 1, 9)) {
+                writer->compressionLevel = level;
+            }
+        }
+        ImGui::Dummy(ImVec2(0.0f, 4.0f));
+        int policy = writer->backpressure.load();
+        if (ImGui::Combo("When queue is full", &policy, backpressurePolicies, IM_ARRAYSIZE(backpressurePolicies))) {
+            writer->backpressure = (WriterBackpressure)policy;
+        }
+        int queueCapacity = writer->queueCapacity.load();
+        if (ImGui::SliderInt("Queue frames", &queueCapacity, 1, 32)) {
+            writer->queueCapacity = queueCapacity;
+        }
+        ImGui::Text("Queue depth:\t%d/%d frames", writer->queueDepth.load(), queueCapacity);
+        ImGui::ProgressBar((float)writer->queueDepth.load() / queueCapacity);
+        ImGui::Text("Written:\t%llu", (unsigned long long)writer->framesWritten.load());
+        ImGui::Text("Dropped:\t%llu", (unsigned long long)writer->framesDropped.load());
+        ImGui::Text("Spilled:\t%llu", (unsigned long long)writer->framesSpilled.load());
+        double writeMilliseconds = writer->lastWriteMilliseconds.load();
+        uint64_t fileBytes = writer->lastFileBytes.load();
+        ImGui::Text("Last write:\t%.1f ms", writeMilliseconds);
+        ImGui::Text("Throughput:\t%.1f MB/s", writeMilliseconds > 0 ? writer->lastFrameBytes.load() / 1e3 / writeMilliseconds : 0.0);
+        ImGui::Text("Ratio:\t\t%.2f:1", fileBytes ? (double)writer->lastFrameBytes.load() / fileBytes : 0.0);
 
         ImGui::End();
     }
 }
 
 void SendCommand(uint8_t command, const SEMCapture &capture) {
-    ssize_t bytesWritten = write(capture.datafile, &command, 1);
-    Logger::Instance()->log("num bytes written: %d", bytesWritten);
+    if (!capture.source || !capture.source->sendCommand(command)) {
+        Logger::Instance()->log("Unable to send command 0x%X to the capture source", command);
+    }
 }
 
 void CreateWindow(SDL_WindowFlags &windowFlags, SDL_Window *&window, SDL_GLContext &glContext) {
@@ -289,13 +512,15 @@ void CreateWindow(SDL_WindowFlags &windowFlags, SDL_Window *&window, SDL_GLConte
     SDL_GL_MakeCurrent(window, glContext);
 }
 
-void Quit(SDL_Window *window, SDL_GLContext &glContext, uint8_t *pixels) {
+void Quit(SDL_Window *window, SDL_GLContext &glContext) {
+    liveImageShader.destroy();
+    stackTexture.destroy();
+    textureStreamer.destroy();
+    liveTexture.destroy();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
 
-    free(pixels);
-
     SDL_GL_DeleteContext(glContext);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -345,174 +570,192 @@ void SetGLAttributes() {
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 }
 
-void setupTexture(GLuint *glTexture, uint8_t *pixels, SEMCapture *capture) {
-    glGenTextures(1, glTexture);
-    glBindTexture(GL_TEXTURE_2D, *glTexture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-#if defined(GL_UNPACK_ROW_LENGTH) && !defined(__EMSCRIPTEN__)
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-#endif
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, capture->sourceWidth, capture->sourceHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-        pixels);
+/**
+ * Reports the queue depths only the UI can see and lets the monitor take its sample for the performance window
+ */
+void SamplePerformance(SEMCapture &capture, SEMCapturePixels &capturePixels) {
+    PerfMonitor *monitor = PerfMonitor::Instance();
 
+    if (capture.ring) {
+        monitor->setDepth(PERF_QUEUE_SAMPLE_RING, capture.ring->getFillLevel());
+    }
+    monitor->setDepth(PERF_QUEUE_WRITER, writer->queueDepth.load());
+    monitor->setDepth(PERF_QUEUE_FRAME_BUFFERS, capturePixels.frames.getBufferCount());
+    monitor->sample();
 }
 
 /**
- *
- * @param ci
- * @param dataFilePath
- * @return True if init success, false otherwise
+ * Sets the live image shader's window: percentiles of the image's histogram, its sample range, or the one set by hand
+ * @param min Smallest sample in the image being shown
+ * @param max Largest
+ * @param histogram The image's, SAMPLE_HISTOGRAM_BINS + 1 bins
+ * @param histogramSamples Samples counted in histogram
  */
-bool InitSEMCapture(SEMCapture *ci, const char *dataFilePath, struct termios *termios) {
-    bool succ = true;
-    ci->dataBuffer = static_cast<uint16_t *>(malloc(ci->BUF_SIZEOF_BYTES));
-    memset(ci->dataBuffer, 0xFF, ci->BUF_SIZEOF_BYTES);
-
-    if (currentTtySource == 0) {
-        ci->datafile = open(dataFilePath, O_RDONLY, 0);
-    } else {
-        ci->datafile = open(dataFilePath, O_RDWR, 0);
-    }
-    if (ci->datafile == -1) {
-        Logger::Instance()->log("Unable to open file %s!", dataFilePath);
-        succ = false;
+void SetDisplayWindow(uint16_t min, uint16_t max, const uint32_t *histogram, uint64_t histogramSamples) {
+    if (windowMode == WINDOW_MANUAL) {
+        liveImageShader.setWindow(windowBlack, windowWhite);
+    } else if (windowMode == WINDOW_PERCENTILES && histogramSamples) {
+        uint32_t black = SampleHistogram::Percentile(histogram, SAMPLE_HISTOGRAM_BINS, histogramSamples,
+                                                     windowLowPercent / 100.0);
+        uint32_t white = SampleHistogram::Percentile(histogram, SAMPLE_HISTOGRAM_BINS, histogramSamples,
+                                                     windowHighPercent / 100.0);
+        liveImageShader.setWindow(black, white > black ? white : black + 1);
+    } else if (min < max) {
+        liveImageShader.setWindow(min, max);
     } else {
-        tcflush(ci->datafile, TCIOFLUSH);
+        // Nothing seen since min/max were reset
+        liveImageShader.setWindow(0, MAX_ADC_VAL - 1);
     }
-
-    tcgetattr(ci->datafile, termios);
-    termios->c_lflag &= ~ICANON;
-    termios->c_cc[VTIME] = 10; // 1 second max blocking time
-    termios->c_cc[VMIN] = 0;   // return even if no chars (idle serial)
-    tcsetattr(ci->datafile, TCSANOW, termios);
-
-    return succ;
 }
 
-void DeleteSEMCapture(SEMCapture *ci) {
-    free(ci->dataBuffer);
-    if (ci->datafile != -1) {
-        close(ci->datafile);
+/**
+ * Plots histogram over the range of samples it has, on a log scale so the tails show, with the display window
+ * marked on it
+ */
+void PlotSampleHistogram(const uint32_t *histogram) {
+    const int plotBins = 256;
+    float plot[plotBins] = {};
+    uint32_t first = 0;
+    uint32_t last = SAMPLE_HISTOGRAM_BINS - 1;
+
+    while (first < last && !histogram[first]) {
+        first++;
+    }
+    while (last > first && !histogram[last]) {
+        last--;
+    }
+    uint32_t span = last - first + 1;
+    for (uint32_t i=first; i<=last; i++) {
+        plot[(uint64_t)(i - first) * plotBins / span] += histogram[i];
+    }
+    for (float &bin : plot) {
+        bin = log10f(1.0f + bin);
     }
-}
-
-void ParseSEMCaptureData(SEMCapture *ci, SEMCapturePixels *p, ssize_t bytesRead) {
-    uint16_t *buf = ci->dataBuffer;
-    double pixelIntensity = 0;
-    uint32_t val;
-    uint32_t loc;
 
-    auto _rowTimeStart = std::chrono::high_resolution_clock::now();
-    for (uint16_t i=0; i<(bytesRead/sizeof(uint16_t)); i++) {
-        while (buf[i] == 0xFEFA || buf[i] == 0xFEFB || buf[i] == 0xFEFC) {
-            ParseStatusBytes(ci, p, i);
-        }
-        if (i >= (bytesRead/sizeof(uint16_t))) {
-            break;
-        }
-        if (buf[i] > p->max && buf[i] < MAX_ADC_VAL) {
-            p->max = buf[i];
-            Logger::Instance()->log("min/max: %d/%d", p->min, p->max);
-        }
-        if (buf[i] < p->min) {
-            p->min = buf[i];
-            Logger::Instance()->log("min/max: %d/%d", p->min, p->max);
-        }
-        if (p->max == 0) {
-            p->max = 1;
-        }
-        if (p->y >= ci->sourceHeight) {
-            p->y = 0;
-            Logger::Instance()->log("Frame overflow at byte: %d", bytesRead);
-        }
-        if (p->x < ci->sourceWidth) {
-            val = ( ((double)buf[i]) / p->max ) * 255;
-            if (val > 255) {
-                val = 255;
-            }
-            loc = ( ( (p->y) * ci->sourceWidth ) + p->x) * 4;
-            p->pixels[loc]        = val; // R
-            p->pixels[loc + 1]    = val; // G
-            p->pixels[loc + 2]    = val; // B
-            p->pixels[loc + 3]    = val; // A
-
-//            p->pixels[((p->y * ci->sourceWidth) + (p->x) ) *3]        = val; // R
-//            p->pixels[(((p->y * ci->sourceWidth) + (p->x) ) *3) + 1]    = val; // G
-//            p->pixels[(((p->y * ci->sourceWidth) + (p->x) ) *3) + 2]    = val; // B
-        } else {
-            Logger::Instance()->log("x overflow at: %d", p->x);
-            p->x = 0;
-            p->y += 1;
+    char overlay[32];
+    snprintf(overlay, sizeof(overlay), "%u - %u", first, last);
+    ImGui::PlotHistogram("##histogram", plot, plotBins, 0, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+
+    // The window, as lines where black and white fall
+    ImVec2 plotMin = ImGui::GetItemRectMin();
+    ImVec2 plotMax = ImGui::GetItemRectMax();
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    for (float level : { liveImageShader.black, liveImageShader.white }) {
+        float x = plotMin.x + (plotMax.x - plotMin.x) * (level - first) / span;
+        if (x >= plotMin.x && x <= plotMax.x) {
+            drawList->AddLine(ImVec2(x, plotMin.y), ImVec2(x, plotMax.y), IM_COL32(255, 80, 80, 255));
         }
-        p->x += 1;
     }
-    auto _rowTimeStop = std::chrono::high_resolution_clock::now();
-    ci->lastRowDurationMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(_rowTimeStop - _rowTimeStart).count();
 }
 
 /**
- * Status bytes are sent every X and/or Y pulse
- * @param ci
- * @param p
- * @param totalBytesRead  Reference to the total number of bytes read. Will be incremented
- * @param i Reference to the iterator over the ci->dataBuffer. Will be incremented
+ * Copies the stacker's latest average into stackTexture when there's a new one
  */
-void ParseStatusBytes(SEMCapture *ci, SEMCapturePixels *p, uint16_t &i) {
-    uint16_t *buf = ci->dataBuffer;
-    if (buf[i] == 0xFEFB) {
-//        Logger::Instance()->log("New frame");
-        ci->newFrame = 1;
-    } else if (buf[i] == 0xFEFC) {
-        Logger::Instance()->log("Heartbeat!");
-        ci->heartbeat = 1;
-        i+=6;
+void UploadStackPreview() {
+    const SEMFrameSnapshot *preview;
+
+    if (stacker->previewVersion.load() == stackPreviewVersion || !(preview = stacker->lockPreview())) {
         return;
     }
-    ci->syncDuration    = buf[++i];
-    ci->syncDuration   += ((double)buf[++i]) / 1e6;
-    ci->scanMode        = buf[++i];
-    ci->frameDuration   = buf[++i] / 16;
-    ci->frameDuration  += ((double)buf[++i]) / 1e6;
-
-    if (ci->syncDuration > ci->maxSync) {
-        ci->maxSync = ci->syncDuration;
+    if (preview->width != stackTexture.getWidth() || preview->height != stackTexture.getHeight()) {
+        stackTexture.allocate(preview->width, preview->height);
     }
-    if (ci->syncDuration < ci->minSync) {
-        ci->minSync = ci->syncDuration;
+    stackTexture.upload(preview->pixels, 0, preview->height, 0, nullptr, 0);
+    if (preview->stackedFrames == 1) {
+        // A new stack
+        std::fill(driftHistoryX, driftHistoryX + driftHistoryLength, 0.0f);
+        std::fill(driftHistoryY, driftHistoryY + driftHistoryLength, 0.0f);
     }
+    driftHistoryX[driftHistoryNext] = preview->driftX;
+    driftHistoryY[driftHistoryNext] = preview->driftY;
+    driftHistoryNext = (driftHistoryNext + 1) % driftHistoryLength;
+    stackPreviewMin = preview->min;
+    // Counted on the stacking thread; only copied here
+    const uint32_t *histogram = stacker->getPreviewHistogram(&stackHistogramSamples);
+    std::copy(histogram, histogram + SAMPLE_HISTOGRAM_BINS + 1, stackHistogram);
+    stackPreviewMax = preview->max;
+    stackPreviewVersion = stacker->previewVersion.load();
+    stacker->unlockPreview();
+}
 
-    if (ci->newFrame) {
-        // This pulse is an X+Y pulse
-        ci->newFrame = 0;
-        p->x = 0;
-        p->y = 0;
-        if (writer && writer->shouldWrite) {
-            free(writer->saveNextFileInSequence(*ci, *p));
-        }
-    } else {
-        // Just an X pulse
-//        Logger::Instance()->log("x pulse\n\tx: %d\n\tscanMode: %d\n\tpulse duration: %f\n\tframe duration: %f", p->x, ci->scanMode, ci->syncDuration, ci->frameDuration);
-//        Logger::Instance()->log("\tsyncAverage: %f\n\tmaxSync: %f\n\tminSync: %f", ci->syncAverage/ci->syncNum, ci->maxSync, ci->minSync);
-        p->x = 0;
-        p->y += 1;
+/**
+ * @param sourceIndex Index into captureSources
+ * @return A new, unopened CaptureSource
+ */
+CaptureSource *CreateCaptureSource(int sourceIndex) {
+    FileReplaySource *replay;
+
+    switch (sourceIndex) {
+        case CAPTURE_SOURCE_RECORDING:
+            replay = new FileReplaySource(captureSources[sourceIndex]);
+            replay->mode = (ReplayMode)currentReplayMode;
+            return replay;
+        case CAPTURE_SOURCE_SIMULATOR:
+            return new SimulatedSource(simulatorConfig);
+        default:
+            return new SerialSource(captureSources[sourceIndex]);
     }
-    ci->syncNum += 1;
-    ci->syncAverage += ci->syncDuration;
+}
 
-    i++;
+/**
+ *
+ * @param ci
+ * @param sourceIndex Index into captureSources
+ * @return True if init success, false otherwise
+ */
+bool InitSEMCapture(SEMCapture *ci, int sourceIndex) {
+    ci->ring = new SampleRing();
+    ci->source = CreateCaptureSource(sourceIndex);
+    return ci->source->open();
 }
 
-void GrabBytes(ssize_t &bytesRead, SEMCapture &ci, std::mutex &bufferLock) {
+void DeleteSEMCapture(SEMCapture *ci) {
+    delete ci->ring;
+    ci->ring = nullptr;
+    delete ci->source;
+    ci->source = nullptr;
+}
+
+/**
+ * Acquisition thread. Reads from the capture source straight into the sample ring and never waits on the parser. If
+ * the ring is full and the source is live the bytes are still read (so the device doesn't back up) but are dropped
+ * and counted as an overrun; other sources just wait for the decoder to catch up.
+ */
+void GrabBytes(SEMCapture &ci) {
+    SampleChunk *scratch = new SampleChunk();
+    ssize_t bytesRead;
+
     while (ci.shouldCapture) {
-        if (ci.bufferReadyForWrite) {
-            bufferLock.lock();
-            ci.bufferReadyForWrite = false;
-            bytesRead = read(ci.datafile, ci.dataBuffer, ci.BUF_SIZEOF_BYTES);
-            bufferLock.unlock();
+        SampleChunk *chunk = ci.ring->acquireWrite();
+        if (chunk == nullptr) {
+            if (ci.source->isLive()) {
+                bytesRead = ci.source->read(scratch);
+                if (bytesRead > 0) {
+                    ci.ring->recordOverrun(bytesRead);
+                }
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            continue;
+        }
+
+        int64_t readStart = PerfMonitor::Now();
+        bytesRead = ci.source->read(chunk);
+        if (bytesRead <= 0) {
+            ci.status = CaptureStatus::STATUS_PAUSED;
+            if (!ci.source->isLive()) {
+                // End of a recording or waiting on a single step; a tty read already blocks for up to a second
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+//            Logger::Instance()->log("End of data or error. Status: %d. Errno: %d", bytesRead, errno);
+        } else {
+            ci.status = CaptureStatus::STATUS_RUNNING;
+            chunk->bytes = bytesRead;
+            chunk->committedNanoseconds = PerfMonitor::Now();
+            PerfMonitor::Instance()->record(PERF_READ, chunk->committedNanoseconds - readStart);
+            PerfMonitor::Instance()->count(PERF_BYTES_READ, bytesRead);
+            ci.ring->commitWrite();
         }
     }
+    delete scratch;
 }
@@ -1,9 +1,14 @@
 #ifndef S2500_IMAGE_VIEWER_SEM_CAPTURE_INFO_H
 #define S2500_IMAGE_VIEWER_SEM_CAPTURE_INFO_H
 
+#include <atomic>
 #include <cstdint>
 
+#define SYNC_PACKET_SAMPLES 6 // 0xFEFA/0xFEFB/0xFEFC marker plus 5 status words
+
 class SequenceWriter;
+class SampleRing;
+class CaptureSource;
 
 enum CaptureStatus {
     STATUS_RUNNING,
@@ -12,13 +17,14 @@ enum CaptureStatus {
     STATUS_UNINITIALIZED,
 };
 
+/**
+ * The frame size and sync state belong to the decoder thread while it runs; everyone else reads them from the capture
+ * state of a published frame (see SEMFrameSnapshot::setCaptureState). Only the atomics are shared.
+ */
 struct SEMCapture {
-    uint16_t *dataBuffer = nullptr;
-//    const uint16_t BUF_SIZE_SAMPLES = 1024;
-    const uint16_t BUF_SIZE_SAMPLES = 8192;
-    const uint16_t BUF_SIZEOF_BYTES = sizeof(uint16_t) * BUF_SIZE_SAMPLES;
-    int datafile = 0;
-    uint16_t sourceWidth = 4096; // must be divisible by 4
+    SampleRing *ring = nullptr;
+    CaptureSource *source = nullptr;
+    uint16_t sourceWidth = 4096; // until the decoder has measured the frames; always divisible by 4
     uint16_t sourceHeight = 4096;
     double syncDuration = 0;
     double frameDuration = 0;
@@ -27,13 +33,10 @@ struct SEMCapture {
     double maxSync = 0;
     double syncAverage = 0;
     uint32_t syncNum = 0;
-    double bytesRead = 0;
-    uint8_t newFrame = 0;
-    CaptureStatus status = STATUS_UNINITIALIZED;
-    uint8_t heartbeat = 0;
-    bool shouldCapture = false;
-    bool bufferReadyForWrite = true;
-    double lastRowDurationMicroseconds = -1;
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<CaptureStatus> status{STATUS_UNINITIALIZED};
+    std::atomic<bool> heartbeat{false};         // set by the decoder, taken by the UI
+    std::atomic<bool> shouldCapture{false};
 };
 
 #endif //S2500_IMAGE_VIEWER_SEM_CAPTURE_INFO_H
@@ -1,12 +1,24 @@
 #ifndef S2500_IMAGE_VIEWER_SEM_CAPTURE_PIXELS_H
 #define S2500_IMAGE_VIEWER_SEM_CAPTURE_PIXELS_H
 
+#include <atomic>
+#include <cstdint>
+#include "FrameStore.h"
+#include "SampleHistogram.h"
+
 struct SEMCapturePixels {
-    uint8_t *pixels;
+    uint16_t *pixels = nullptr;           // raw ADC samples, one per pixel: the back buffer, for the decoder only
     int32_t x = 0;
     int32_t y = 0;
     uint16_t min = 65535;
     uint16_t max = 0;
+    std::atomic<uint32_t> frameNumber{0}; // bumped by the decoder on every frame sync
+    FrameStore frames;                    // where everyone else gets their frames from
+    SampleHistogram histogram;            // of the last frame and this one so far
+
+    void allocate(uint16_t width, uint16_t height) {
+        pixels = frames.allocate(width, height);
+    }
 };
 
 #endif //S2500_IMAGE_VIEWER_SEM_CAPTURE_PIXELS_H
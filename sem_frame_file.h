@@ -0,0 +1,45 @@
+#ifndef S2500_IMAGE_VIEWER_SEM_FRAME_FILE_H
+#define S2500_IMAGE_VIEWER_SEM_FRAME_FILE_H
+
+#include <cstdint>
+
+#define SEM_FRAME_FILE_MAGIC        "S2500RAW" // 8 bytes, no terminator in the file
+#define SEM_FRAME_FILE_VERSION      3
+#define SEM_FRAME_FILE_HEADER_BYTES 4096       // pixels start on a page boundary so a mapping of the file can use them in place
+
+/**
+ * Header of a .s2r frame file: the raw little-endian uint16 samples of one frame, row by row, preceded by this header
+ * zero-padded to SEM_FRAME_FILE_HEADER_BYTES. Fields only ever get added at the end, with the version bumped.
+ */
+struct SEMFrameFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;               // offset of the first sample
+    uint32_t width;
+    uint32_t height;
+    uint32_t bitsPerSample;             // 16
+    uint32_t adcMax;                    // samples at or above this are out of range (MAX_ADC_VAL)
+    uint32_t frameNumber;
+    uint32_t syncNum;
+    int32_t sequenceNumber;
+    int32_t fileNumber;
+    uint16_t min;
+    uint16_t max;
+    uint8_t scanMode;
+    uint8_t reserved[3];
+    int64_t timestampNanoseconds;       // wall clock at frame sync, since the Unix epoch
+    double frameDuration;               // row time of the last row
+    double minSync;
+    double maxSync;
+    double syncAverage;
+    // Version 2
+    uint32_t stackedFrames;             // frames averaged into this one, 1 for a plain capture
+    uint32_t reserved2;
+    // Version 3
+    float driftX;                       // of the last stacked frame, in pixels; every frame's is in NNNN.drift.csv
+    float driftY;
+};
+
+static_assert(sizeof(SEMFrameFileHeader) == 112, "SEMFrameFileHeader layout is part of the file format");
+
+#endif //S2500_IMAGE_VIEWER_SEM_FRAME_FILE_H
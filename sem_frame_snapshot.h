@@ -0,0 +1,74 @@
+#ifndef S2500_IMAGE_VIEWER_SEM_FRAME_SNAPSHOT_H
+#define S2500_IMAGE_VIEWER_SEM_FRAME_SNAPSHOT_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "sem_capture_info.h"
+#include "sem_capture_pixels.h"
+
+// Drift registration of one frame of a stack against its first frame
+struct FrameDrift {
+    uint32_t frameNumber;
+    float driftX;                       // in pixels
+    float driftY;
+    float peak;                         // correlation peak of the match, 0 to 1
+    bool stacked;                       // false if it couldn't be matched and was left out
+};
+
+/**
+ * A finished frame in the SEMCapturePixels frame store, or a copy of one, along with the capture state it was taken
+ * under, so it can be written to disk or stacked on another thread while the decoder carries on with the next frame.
+ */
+struct SEMFrameSnapshot {
+    uint16_t *pixels = nullptr;         // raw ADC samples, width * height. Not valid while spilled
+    size_t capacity = 0;                // samples allocated in pixels
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint16_t min = 0;
+    uint16_t max = 0;
+    uint8_t scanMode = 0;
+    double frameDuration = 0;           // row time of the last row
+    double syncDuration = 0;            // of the frame sync pulse
+    double minSync = 0;
+    double maxSync = 0;
+    double syncAverage = 0;             // mean sync duration so far
+    uint32_t syncNum = 0;
+    uint32_t frameNumber = 0;
+    int64_t timestampNanoseconds = 0;   // wall clock at frame sync
+    int sequenceNumber = 0;
+    int fileNumber = 0;                 // given by the writer as the frame is written
+    int spillNumber = 0;                // names the spill file while spilled
+    uint32_t stackedFrames = 1;         // frames averaged into this one
+    float driftX = 0;                   // registration shift of the last frame stacked, in pixels
+    float driftY = 0;
+    bool spilled = false;               // pixels are in the spill file instead of memory
+    bool requested = false;             // saved by "Save next frame" rather than as part of a sequence
+    std::vector<FrameDrift> drift;      // per frame, for a stack saved with drift correction
+
+    // Copies the capture state that goes with the frame currently in the frame store; leaves pixels alone
+    void setCaptureState(const SEMCapture &captureInfo, const SEMCapturePixels &frame) {
+        width = captureInfo.sourceWidth;
+        height = captureInfo.sourceHeight;
+        min = frame.min;
+        max = frame.max;
+        scanMode = captureInfo.scanMode;
+        frameDuration = captureInfo.frameDuration;
+        syncDuration = captureInfo.syncDuration;
+        minSync = captureInfo.minSync;
+        maxSync = captureInfo.maxSync;
+        syncAverage = captureInfo.syncNum ? captureInfo.syncAverage / captureInfo.syncNum : 0;
+        syncNum = captureInfo.syncNum;
+        frameNumber = frame.frameNumber.load(std::memory_order_relaxed);
+        timestampNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        stackedFrames = 1;
+        driftX = 0;
+        driftY = 0;
+        requested = false;
+        drift.clear();
+    }
+};
+
+#endif //S2500_IMAGE_VIEWER_SEM_FRAME_SNAPSHOT_H